@@ -21,8 +21,8 @@ static const char *TAG = "perf";
 // Event group for various waiting processes
 static EventGroupHandle_t my_event_group;
 
-// IP addresses: mine, connected node
-static esp_ip4_addr_t my_ip, node_ip;
+// IP addresses: mine, connected node, root (gateway of the node)
+static esp_ip4_addr_t my_ip, node_ip, root_ip;
 
 // Event handler for IP_EVENT
 static void got_ip_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
@@ -31,6 +31,7 @@ static void got_ip_handler(void *arg, esp_event_base_t event_base, int32_t event
 
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     my_ip = event->ip_info.ip;
+    root_ip = event->ip_info.gw;
 
     ESP_LOGI(TAG, "Got IP: " IPSTR, IP2STR(&my_ip));
 
@@ -52,18 +53,27 @@ static void assigned_ip_handler(void *arg, esp_event_base_t event_base, int32_t
     xEventGroupSetBits(my_event_group, ASSIGNED_IP_BIT);
 }
 
+// Whether this device sends the iperf traffic
+static bool is_client() {
+#if CONFIG_PERF_ROOT_INGRESS
+    return !is_root();
+#else
+    return is_root();
+#endif
+}
+
 static void perform_iperf() {
-    ESP_LOGI(TAG, "Starting iperf %s", is_root() ? "client" : "server");
+    ESP_LOGI(TAG, "Starting iperf %s", is_client() ? "client" : "server");
 
     iperf_cfg_t cfg;
-    cfg.flag = is_root() ? IPERF_FLAG_CLIENT : IPERF_FLAG_SERVER;
+    cfg.flag = is_client() ? IPERF_FLAG_CLIENT : IPERF_FLAG_SERVER;
     // TCP since we want a measurement for MQTT, HTTP, etc.
     cfg.flag |= IPERF_FLAG_TCP;
     // only IPv4 is supported
     cfg.type = IPERF_IP_TYPE_IPV4;
     // set IP addresses
-    if (is_root()) {
-        cfg.destination_ip4 = node_ip.addr;
+    if (is_client()) {
+        cfg.destination_ip4 = is_root() ? node_ip.addr : root_ip.addr;
     }
     cfg.source_ip4 = my_ip.addr;
     // default port
@@ -125,7 +135,12 @@ void app_main(void) {
 
         ESP_LOGI(TAG, "Got my IP, continuing");
 
-        // we can now start the iperf server as the node
+        if (is_client()) {
+            // wait to make sure the root has started its iperf server
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+
+        // we can now start iperf as the node
         perform_iperf();
     } else {
         ESP_LOGI(TAG, "Waiting for node to connect");
@@ -135,10 +150,12 @@ void app_main(void) {
 
         ESP_LOGI(TAG, "Node connected, continuing");
 
-        // wait to make sure the node has started its iperf server
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (is_client()) {
+            // wait to make sure the node has started its iperf server
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
 
-        // can now start the iperf client
+        // can now start iperf as the root
         perform_iperf();
     }
 }
@@ -0,0 +1,131 @@
+#include "arp_proxy.hpp"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "util/mutex.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::arp_proxy {
+
+static constexpr auto TAG = CREATE_TAG("ArpProxy");
+
+// how many addresses are kept at most, the oldest one is forgotten first
+static constexpr auto MAX_ENTRIES{64};
+
+static constexpr size_t ETH_HEADER_SIZE{14};
+static constexpr size_t ARP_SIZE{28};
+
+namespace {
+
+using Ip4 = std::array<uint8_t, 4>;
+
+struct Entry {
+    Ip4 ip;
+    util::MacAddr mac;
+};
+
+// learned in the IO receive task, forgotten in the job runner and looked up in the TCP/IP task, which must not wait for
+// the global lock
+util::Mutex mutex;
+
+std::vector<Entry> entries;
+
+void remember(const Ip4& ip, const util::MacAddr& mac) {
+    if (ip == Ip4{}) return;
+
+    std::lock_guard lock{mutex};
+    // a node may have gotten a new address and an address may have been handed to another node
+    std::erase_if(entries, [&](const Entry& entry) { return entry.ip == ip || entry.mac == mac; });
+    if (entries.size() == MAX_ENTRIES) entries.erase(entries.begin());
+    entries.push_back(Entry{ip, mac});
+}
+
+std::optional<util::MacAddr> lookup(const Ip4& ip) {
+    std::lock_guard lock{mutex};
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& entry) { return entry.ip == ip; });
+    if (it == entries.end()) return std::nullopt;
+    return it->mac;
+}
+
+bool isArp(const uint8_t* eth) {
+    const auto* arp = eth + ETH_HEADER_SIZE;
+    // Ethernet and IPv4 addresses
+    return eth[12] == 0x08 && eth[13] == 0x06 && arp[0] == 0x00 && arp[1] == 0x01 && arp[2] == 0x08 &&
+           arp[3] == 0x00 && arp[4] == 6 && arp[5] == 4;
+}
+
+}  // namespace
+
+void learn(const pbuf* frame) {
+    std::array<uint8_t, ETH_HEADER_SIZE + ARP_SIZE> header;
+    if (frame->tot_len < ETH_HEADER_SIZE + 20) return;
+    auto size = pbuf_copy_partial(frame, header.data(), std::min<size_t>(header.size(), frame->tot_len), 0);
+
+    const auto* payload = header.data() + ETH_HEADER_SIZE;
+    Ip4 ip;
+    if (size == header.size() && isArp(header.data())) {
+        // sender protocol address
+        std::copy_n(payload + 14, ip.size(), ip.begin());
+        remember(ip, util::MacAddr{payload + 8});
+    } else if (header[12] == 0x08 && header[13] == 0x00) {
+        // IPv4 source address
+        std::copy_n(payload + 12, ip.size(), ip.begin());
+        remember(ip, util::MacAddr{header.data() + 6});
+    }
+}
+
+util::PbufPtr answer(const pbuf* frame) {
+    std::array<uint8_t, ETH_HEADER_SIZE + ARP_SIZE> request;
+    if (frame->tot_len < request.size()) return nullptr;
+    pbuf_copy_partial(frame, request.data(), request.size(), 0);
+
+    const auto* arp = request.data() + ETH_HEADER_SIZE;
+    // only requests (operation 1)
+    if (!isArp(request.data()) || arp[6] != 0x00 || arp[7] != 0x01) return nullptr;
+
+    Ip4 target;
+    std::copy_n(arp + 24, target.size(), target.begin());
+    auto mac = lookup(target);
+    if (!mac) return nullptr;
+
+    util::PbufPtr reply{pbuf_alloc(PBUF_RAW, request.size(), PBUF_RAM)};
+    if (!reply) return nullptr;
+
+    std::array<uint8_t, ETH_HEADER_SIZE + ARP_SIZE> data;
+    // Ethernet header: back to the requester, from the node
+    std::copy_n(request.begin() + 6, 6, data.begin());
+    std::copy(mac->addr.begin(), mac->addr.end(), data.begin() + 6);
+    data[12] = 0x08;
+    data[13] = 0x06;
+    // same address types, operation 2 (reply)
+    auto* reply_arp = data.data() + ETH_HEADER_SIZE;
+    std::copy_n(arp, 6, reply_arp);
+    reply_arp[6] = 0x00;
+    reply_arp[7] = 0x02;
+    // the node is the sender, the requester the target
+    std::copy(mac->addr.begin(), mac->addr.end(), reply_arp + 8);
+    std::copy_n(arp + 24, 4, reply_arp + 14);
+    std::copy_n(arp + 8, 10, reply_arp + 18);
+    pbuf_take(reply.get(), data.data(), data.size());
+
+    ESP_LOGV(TAG, "Answered ARP request for " MACSTR, MAC2STR(*mac));
+    return reply;
+}
+
+void forget(const util::MacAddr& mac) {
+    std::lock_guard lock{mutex};
+    std::erase_if(entries, [&](const Entry& entry) { return entry.mac == mac; });
+}
+
+void reset() {
+    std::lock_guard lock{mutex};
+    entries.clear();
+}
+
+}  // namespace meshnow::arp_proxy
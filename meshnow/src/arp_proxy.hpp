@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "util/mac.hpp"
+#include "util/pbuf.hpp"
+
+namespace meshnow::arp_proxy {
+
+/**
+ * Root only: answers the ARP requests of the root's own stack for mesh nodes, so they are not flooded through the mesh.
+ *
+ * The IP address of every node is learned from the frames it sends to the root, which always start with an ARP request
+ * for the gateway. A request is only answered for nodes that are currently part of the mesh, since the address of a
+ * node is forgotten once it leaves.
+ */
+
+/**
+ * Learns the IP address of the sender of a frame received from the mesh.
+ */
+void learn(const pbuf* frame);
+
+/**
+ * Answers an outgoing ARP request.
+ * @return the ARP reply to hand back to the stack, or nullptr if the request has to be sent
+ */
+util::PbufPtr answer(const pbuf* frame);
+
+/**
+ * Forgets the address of a node that left the mesh.
+ */
+void forget(const util::MacAddr& mac);
+
+/**
+ * Forgets all learned addresses.
+ */
+void reset();
+
+}  // namespace meshnow::arp_proxy
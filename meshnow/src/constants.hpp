@@ -1,6 +1,7 @@
 #pragma once
 
 #include <esp_now.h>
+#include <sdkconfig.h>
 
 #include <array>
 #include <cstdint>
@@ -10,8 +11,32 @@ namespace meshnow {
 // PACKETS
 constexpr std::array<uint8_t, 3> MAGIC{0x55, 0x77, 0x55};
 constexpr auto HEADER_SIZE{20};
-constexpr auto MAX_FRAG_PAYLOAD_SIZE{ESP_NOW_MAX_DATA_LEN - HEADER_SIZE - 6};
+// compact headers start with this version byte instead of the magic bytes and carry short IDs instead of MAC addresses
+constexpr uint8_t COMPACT_HEADER_VERSION{0xC1};
+constexpr auto COMPACT_HEADER_SIZE{8};
+constexpr auto FRAG_HEADER_SIZE{6};
+constexpr auto MAX_FRAG_PAYLOAD_SIZE{ESP_NOW_MAX_DATA_LEN - HEADER_SIZE - FRAG_HEADER_SIZE};
 constexpr auto MAX_CUSTOM_PAYLOAD_SIZE{ESP_NOW_MAX_DATA_LEN - HEADER_SIZE};
+// aggregates stay within a regular frame, the size of their data takes up to 2 bytes
+constexpr auto MAX_AGGREGATE_DATA_SIZE{ESP_NOW_MAX_DATA_LEN - HEADER_SIZE - 2};
+
+// LARGE FRAMES
+// largest frame this node can send and receive, ESP-NOW v2 allows for larger frames than v1
+#if defined(ESP_NOW_MAX_DATA_LEN_V2) && CONFIG_LARGE_FRAMES
+constexpr uint16_t MAX_FRAME_SIZE{ESP_NOW_MAX_DATA_LEN_V2};
+#else
+constexpr uint16_t MAX_FRAME_SIZE{ESP_NOW_MAX_DATA_LEN};
+#endif
+// a large fragment spans this many regular fragments, so that it can be split up again for v1 links
+constexpr auto LARGE_FRAG_UNITS{6};
+constexpr auto LARGE_FRAG_PAYLOAD_SIZE{MAX_FRAG_PAYLOAD_SIZE * LARGE_FRAG_UNITS};
+static_assert(HEADER_SIZE + FRAG_HEADER_SIZE + LARGE_FRAG_PAYLOAD_SIZE <= 1470, "Large fragments must fit ESP-NOW v2");
+
+// FORWARD ERROR CORRECTION
+// the last fragment number carries the XOR of all fragments instead of data
+constexpr uint8_t PARITY_FRAG_NUM{7};
+static_assert((1514 + MAX_FRAG_PAYLOAD_SIZE - 1) / MAX_FRAG_PAYLOAD_SIZE <= PARITY_FRAG_NUM,
+              "Ethernet frames must not need the parity fragment number");
 
 // TASKS
 constexpr auto TASK_PRIORITY{23};
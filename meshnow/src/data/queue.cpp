@@ -0,0 +1,63 @@
+#include "queue.hpp"
+
+#include <esp_log.h>
+#include <sdkconfig.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "layout.hpp"
+#include "packets.hpp"
+#include "util/queue.hpp"
+#include "util/util.hpp"
+
+static constexpr auto QUEUE_SIZE{32};
+
+// credits are advertised early once they grew by this much since the last advertisement
+static constexpr uint8_t CREDITS_STEP{QUEUE_SIZE / 8};
+
+namespace meshnow::data {
+
+static constexpr auto TAG = CREATE_TAG("DataQueue");
+
+static util::Queue<receive::Item> queue;
+
+static std::atomic<uint32_t> dropped_items{0};
+
+esp_err_t init() { return queue.init(QUEUE_SIZE); }
+
+void deinit() { queue = util::Queue<receive::Item>{}; }
+
+void push(receive::Item&& item) {
+    // called from the Wi-Fi task, which must never block
+    // the credits keep neighbors from overrunning it with data, and lost fragments are requested again
+    if (!queue.push_back(std::move(item), 0)) {
+        ESP_LOGD(TAG, "Data queue full, dropping packet");
+        dropped_items++;
+    }
+}
+
+std::optional<receive::Item> pop(TickType_t timeout) { return queue.pop(timeout); }
+
+uint32_t droppedItems() { return dropped_items; }
+
+static uint8_t last_advertised{packets::UNLIMITED_CREDITS};
+
+static uint8_t currentCredits() {
+#if CONFIG_FLOW_CONTROL
+    auto& layout = layout::Layout::get();
+    size_t neighbors = std::max<size_t>(layout.getChildren().size() + (layout.hasParent() ? 1 : 0), 1);
+    return queue.spaces_available() / neighbors;
+#else
+    return packets::UNLIMITED_CREDITS;
+#endif
+}
+
+uint8_t advertiseCredits() {
+    last_advertised = currentCredits();
+    return last_advertised;
+}
+
+bool creditsRecovered() { return currentCredits() >= last_advertised + CREDITS_STEP; }
+
+}  // namespace meshnow::data
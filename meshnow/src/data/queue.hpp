@@ -0,0 +1,53 @@
+#pragma once
+
+#include <esp_err.h>
+#include <freertos/portmacro.h>
+
+#include <optional>
+
+#include "receive/queue.hpp"
+
+namespace meshnow::data {
+
+/**
+ * Initializes the data plane queue.
+ */
+esp_err_t init();
+
+/**
+ * Deinitializes the data plane queue.
+ */
+void deinit();
+
+/**
+ * Pushes a new item to the data plane queue, or drops it if the queue is full.
+ *
+ * @param item Item to push.
+ */
+void push(receive::Item&& item);
+
+/**
+ * Pops an item from the data plane queue.
+ *
+ * @param timeout Timeout in ticks.
+ */
+std::optional<receive::Item> pop(TickType_t timeout);
+
+/**
+ * Returns the number of items that were dropped because the data plane queue was full.
+ */
+uint32_t droppedItems();
+
+/**
+ * Returns the number of frames every neighbor may send to this node until the next status beacon, which is its share
+ * of the free space in the queue, and remembers it as advertised. Must be called with the lock held.
+ */
+uint8_t advertiseCredits();
+
+/**
+ * Returns true iff the queue has drained noticeably since the credits were advertised last, so the neighbors should
+ * learn about it before the next status beacon. Must be called with the lock held.
+ */
+bool creditsRecovered();
+
+}  // namespace meshnow::data
@@ -0,0 +1,124 @@
+#include "worker.hpp"
+
+#include <esp_log.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "job/fragment_gc.hpp"
+#include "job/keep_alive.hpp"
+#include "job/packet_handler.hpp"
+#include "layout.hpp"
+#include "link_quality.hpp"
+#include "lock.hpp"
+#include "queue.hpp"
+#include "util/util.hpp"
+#include "util/waitbits.hpp"
+
+namespace meshnow::data {
+
+static constexpr auto TAG = CREATE_TAG("DataWorker");
+static constexpr auto MIN_TIMEOUT = pdMS_TO_TICKS(500);
+
+// how many items to handle at most before giving other tasks a chance to run
+static constexpr auto MAX_BATCH_SIZE{32};
+
+static TickType_t calculateTimeout(const job::FragmentGCJob& fragment_gc) {
+    auto next_action = fragment_gc.nextActionAt();
+    auto now = xTaskGetTickCount();
+    if (next_action == portMAX_DELAY) return MIN_TIMEOUT;
+    if (next_action <= now) return 0;
+    return std::min(next_action - now, MIN_TIMEOUT);
+}
+
+/**
+ * What the data worker knows about the layout, so that it only takes the lock once per batch instead of per packet.
+ */
+class LayoutSnapshot {
+   public:
+    /**
+     * Whether the sender is a neighbor. Takes the lock only for senders that joined since the last sync.
+     */
+    bool isNeighbor(const util::MacAddr& mac) {
+        if (contains(mac)) return true;
+        Lock lock;
+        refresh();
+        return contains(mac);
+    }
+
+    /**
+     * Remembers the RSSI of a received frame until the next sync.
+     */
+    void addRssi(const util::MacAddr& mac, int rssi) { rssi_samples_.emplace_back(mac, rssi); }
+
+    /**
+     * Applies the collected RSSI samples and refreshes the neighbors. Also lets the neighbors know right away once the
+     * queue has room again, instead of stalling until the next status beacon.
+     */
+    void sync() {
+        Lock lock;
+        auto& layout = layout::Layout::get();
+        for (auto& [mac, rssi] : rssi_samples_) {
+            if (layout.hasNeighbor(mac)) link_quality::onReceive(layout.getNeighbor(mac).link_stats, rssi);
+        }
+        rssi_samples_.clear();
+        refresh();
+        if (creditsRecovered()) job::StatusSendJob::sendStatus();
+    }
+
+   private:
+    bool contains(const util::MacAddr& mac) const {
+        return std::find(neighbors_.begin(), neighbors_.end(), mac) != neighbors_.end();
+    }
+
+    // requires the lock
+    void refresh() {
+        auto& layout = layout::Layout::get();
+        neighbors_.clear();
+        if (layout.hasParent()) neighbors_.push_back(layout.getParent().mac);
+        for (auto& child : layout.getChildren()) neighbors_.push_back(child.mac);
+    }
+
+    // a node that left in the meantime is still accepted until the next sync, which reassembly copes with
+    std::vector<util::MacAddr> neighbors_;
+    std::vector<std::pair<util::MacAddr, int>> rssi_samples_;
+};
+
+void worker_task(bool& should_stop, util::WaitBits& task_waitbits, int data_worker_finished_bit) {
+    ESP_LOGI(TAG, "Starting!");
+
+    // reassembly state is only ever touched from this task, so the garbage collection runs here too
+    job::FragmentGCJob fragment_gc;
+
+    auto last_wake_time = xTaskGetTickCount();
+
+    LayoutSnapshot snapshot;
+
+    while (!should_stop) {
+        // handle a whole batch per cycle so that not every forwarded fragment costs a tick
+        auto timeout = calculateTimeout(fragment_gc);
+        int handled = 0;
+        for (; handled < MAX_BATCH_SIZE; ++handled) {
+            auto item = pop(handled == 0 ? timeout : 0);
+            if (!item) break;
+            auto is_neighbor = snapshot.isNeighbor(item->from);
+            if (is_neighbor) snapshot.addRssi(item->from, item->rssi);
+            job::PacketHandler::handleDataPacket(item->from, is_neighbor, item->packet);
+        }
+
+        if (handled > 0) snapshot.sync();
+
+        if (fragment_gc.nextActionAt() <= xTaskGetTickCount()) {
+            fragment_gc.performAction();
+        }
+
+        // a cycle should at least take 1 tick so not to starve other tasks and trigger the watchdog
+        xTaskDelayUntil(&last_wake_time, 1);
+    }
+
+    ESP_LOGI(TAG, "Stopping!");
+    task_waitbits.set(data_worker_finished_bit);
+}
+
+}  // namespace meshnow::data
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "util/waitbits.hpp"
+
+namespace meshnow::data {
+
+void worker_task(bool& should_stop, util::WaitBits& task_waitbits, int data_worker_finished_bit);
+
+}  // namespace meshnow::data
@@ -0,0 +1,387 @@
+#include "dns_cache.hpp"
+
+#include <esp_check.h>
+#include <esp_log.h>
+#include <esp_random.h>
+#include <freertos/FreeRTOS.h>
+#include <lwip/sockets.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+#include "constants.hpp"
+#include "util/task.hpp"
+#include "util/util.hpp"
+#include "util/waitbits.hpp"
+
+namespace meshnow::dns_cache {
+
+static constexpr auto TAG = CREATE_TAG("DnsCache");
+
+static constexpr uint16_t DNS_PORT{53};
+
+// DNS over UDP without EDNS, larger answers are truncated by the upstream server and not cached
+static constexpr size_t MAX_MESSAGE_SIZE{512};
+
+static constexpr size_t HEADER_SIZE{12};
+
+// how many answers are kept at most, the one closest to expiring is replaced first
+static constexpr size_t MAX_ENTRIES{16};
+
+// answers are not kept longer than this, even if their TTL allows it
+static constexpr uint32_t MAX_TTL_S{3600};
+
+// how many forwarded queries may wait for an answer at once
+static constexpr size_t MAX_PENDING{16};
+
+// forwarded queries without an answer after this are forgotten, the client retries on its own
+static constexpr auto PENDING_TIMEOUT{pdMS_TO_TICKS(5000)};
+
+// how often the task checks whether it should stop
+static constexpr auto POLL_INTERVAL_MS{500};
+
+static constexpr uint16_t TYPE_OPT{41};
+
+static constexpr auto FINISHED_BIT = BIT0;
+
+namespace {
+
+struct Entry {
+    // question section with the name in lower case
+    std::vector<uint8_t> key;
+    // answer as received from upstream
+    std::vector<uint8_t> answer;
+    // positions of the TTLs in the answer
+    std::vector<uint16_t> ttl_offsets;
+    TickType_t stored_at;
+    TickType_t expires_at;
+};
+
+struct Pending {
+    // transaction ID used towards the upstream server
+    uint16_t upstream_id;
+    // transaction ID chosen by the client
+    uint16_t client_id;
+    sockaddr_in client;
+    std::vector<uint8_t> key;
+    TickType_t sent_at;
+};
+
+// only accessed by the DNS task, start() and stop()
+int server_sock{-1};
+int upstream_sock{-1};
+sockaddr_in upstream_addr;
+
+std::vector<Entry> entries;
+std::vector<Pending> pending;
+
+util::Task task;
+util::WaitBits waitbits;
+std::atomic<bool> should_stop{false};
+
+struct {
+    std::atomic<uint32_t> queries;
+    std::atomic<uint32_t> hits;
+    std::atomic<uint32_t> upstream_queries;
+} stats;
+
+uint16_t read16(const uint8_t* data) { return static_cast<uint16_t>(data[0] << 8 | data[1]); }
+
+uint32_t read32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) << 24 | static_cast<uint32_t>(data[1]) << 16 |
+           static_cast<uint32_t>(data[2]) << 8 | data[3];
+}
+
+void write16(uint8_t* data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+}
+
+void write32(uint8_t* data, uint32_t value) {
+    write16(data, value >> 16);
+    write16(data + 2, value & 0xFFFF);
+}
+
+/**
+ * @return the position after the name starting at pos, or std::nullopt if it is malformed
+ */
+std::optional<size_t> skipName(const uint8_t* msg, size_t len, size_t pos) {
+    while (pos < len) {
+        auto label = msg[pos];
+        if (label == 0) return pos + 1;
+        // compression pointer, always ends the name
+        if ((label & 0xC0) == 0xC0) return pos + 2 <= len ? std::optional{pos + 2} : std::nullopt;
+        if ((label & 0xC0) != 0) return std::nullopt;
+        pos += 1 + label;
+    }
+    return std::nullopt;
+}
+
+/**
+ * Returns the question of a standard query or answer, which identifies it in the cache.
+ * Names are case-insensitive, so the key is in lower case.
+ */
+std::optional<std::vector<uint8_t>> questionKey(const uint8_t* msg, size_t len) {
+    if (len < HEADER_SIZE) return std::nullopt;
+    // standard query with exactly one question
+    if ((msg[2] & 0x78) != 0 || read16(msg + 4) != 1) return std::nullopt;
+
+    auto name_end = skipName(msg, len, HEADER_SIZE);
+    if (!name_end || *name_end + 4 > len) return std::nullopt;
+
+    std::vector<uint8_t> key(msg + HEADER_SIZE, msg + *name_end + 4);
+    std::transform(key.begin(), key.end(), key.begin(), [](uint8_t c) { return std::tolower(c); });
+    return key;
+}
+
+bool isAnswer(const uint8_t* msg) { return (msg[2] & 0x80) != 0; }
+
+void sendTo(int sock, const uint8_t* msg, size_t len, const sockaddr_in& addr) {
+    if (sendto(sock, msg, len, 0, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ESP_LOGW(TAG, "Failed to send DNS message: errno %d", errno);
+    }
+}
+
+/**
+ * Answers a query from the cache.
+ * @return false if there is no valid cached answer
+ */
+bool answerFromCache(const uint8_t* query, const std::vector<uint8_t>& key, const sockaddr_in& client) {
+    auto now = xTaskGetTickCount();
+    std::erase_if(entries, [&](const Entry& entry) { return static_cast<int32_t>(entry.expires_at - now) <= 0; });
+
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry& entry) { return entry.key == key; });
+    if (it == entries.end()) return false;
+
+    auto answer = it->answer;
+    // the client's transaction ID and spelling of the name
+    std::copy_n(query, 2, answer.begin());
+    std::copy_n(query + HEADER_SIZE, key.size(), answer.begin() + HEADER_SIZE);
+
+    // the answer has aged while it was cached
+    uint32_t age_s = pdTICKS_TO_MS(now - it->stored_at) / 1000;
+    for (auto offset : it->ttl_offsets) {
+        auto ttl = read32(answer.data() + offset);
+        write32(answer.data() + offset, ttl > age_s ? ttl - age_s : 0);
+    }
+
+    sendTo(server_sock, answer.data(), answer.size(), client);
+    return true;
+}
+
+/**
+ * Caches an answer if it is complete, successful and has a TTL.
+ */
+void store(const uint8_t* answer, size_t len, std::vector<uint8_t> key) {
+    // not truncated and no error, only positive answers are cached
+    if ((answer[2] & 0x02) != 0 || (answer[3] & 0x0F) != 0) return;
+
+    auto answer_count = read16(answer + 6);
+    if (answer_count == 0) return;
+    size_t record_count = answer_count + read16(answer + 8) + read16(answer + 10);
+
+    std::vector<uint16_t> ttl_offsets;
+    uint32_t ttl_s = MAX_TTL_S;
+    size_t pos = HEADER_SIZE + key.size();
+    for (size_t i = 0; i < record_count; ++i) {
+        auto name_end = skipName(answer, len, pos);
+        if (!name_end || *name_end + 10 > len) return;
+        pos = *name_end;
+        // the TTL field of the EDNS pseudo-record holds flags
+        if (read16(answer + pos) != TYPE_OPT) {
+            ttl_offsets.push_back(pos + 4);
+            ttl_s = std::min(ttl_s, read32(answer + pos + 4));
+        }
+        pos += 10 + read16(answer + pos + 8);
+        if (pos > len) return;
+    }
+    if (ttl_s == 0) return;
+
+    auto now = xTaskGetTickCount();
+    std::erase_if(entries, [&](const Entry& entry) { return entry.key == key; });
+    if (entries.size() == MAX_ENTRIES) {
+        auto soonest = std::min_element(entries.begin(), entries.end(), [&](const Entry& a, const Entry& b) {
+            return a.expires_at - now < b.expires_at - now;
+        });
+        entries.erase(soonest);
+    }
+    entries.push_back(Entry{
+        .key = std::move(key),
+        .answer = std::vector<uint8_t>(answer, answer + len),
+        .ttl_offsets = std::move(ttl_offsets),
+        .stored_at = now,
+        .expires_at = now + pdMS_TO_TICKS(ttl_s * 1000),
+    });
+}
+
+void forward(uint8_t* query, size_t len, std::vector<uint8_t> key, const sockaddr_in& client) {
+    if (pending.size() == MAX_PENDING) pending.erase(pending.begin());
+
+    uint16_t upstream_id;
+    do {
+        upstream_id = esp_random() & 0xFFFF;
+    } while (std::any_of(pending.begin(), pending.end(),
+                         [&](const Pending& p) { return p.upstream_id == upstream_id; }));
+
+    pending.push_back(Pending{
+        .upstream_id = upstream_id,
+        .client_id = read16(query),
+        .client = client,
+        .key = std::move(key),
+        .sent_at = xTaskGetTickCount(),
+    });
+
+    write16(query, upstream_id);
+    sendTo(upstream_sock, query, len, upstream_addr);
+    stats.upstream_queries++;
+}
+
+void handleQuery(uint8_t* buffer) {
+    sockaddr_in client{};
+    socklen_t addr_len = sizeof(client);
+    auto len = recvfrom(server_sock, buffer, MAX_MESSAGE_SIZE, 0, reinterpret_cast<sockaddr*>(&client), &addr_len);
+    if (len < static_cast<ssize_t>(HEADER_SIZE) || isAnswer(buffer)) return;
+
+    stats.queries++;
+
+    auto key = questionKey(buffer, len);
+    if (!key) {
+        // not something we understand, let upstream answer it
+        forward(buffer, len, {}, client);
+        return;
+    }
+
+    if (answerFromCache(buffer, *key, client)) {
+        stats.hits++;
+        return;
+    }
+
+    forward(buffer, len, std::move(*key), client);
+}
+
+void handleAnswer(uint8_t* buffer) {
+    sockaddr_in from{};
+    socklen_t addr_len = sizeof(from);
+    auto len = recvfrom(upstream_sock, buffer, MAX_MESSAGE_SIZE, 0, reinterpret_cast<sockaddr*>(&from), &addr_len);
+    if (len < static_cast<ssize_t>(HEADER_SIZE) || !isAnswer(buffer)) return;
+    if (from.sin_addr.s_addr != upstream_addr.sin_addr.s_addr) return;
+
+    auto id = read16(buffer);
+    auto it = std::find_if(pending.begin(), pending.end(), [&](const Pending& p) { return p.upstream_id == id; });
+    if (it == pending.end()) return;
+    auto query = std::move(*it);
+    pending.erase(it);
+
+    auto key = questionKey(buffer, len);
+    if (!query.key.empty() && key == query.key) {
+        store(buffer, len, std::move(*key));
+    }
+
+    write16(buffer, query.client_id);
+    sendTo(server_sock, buffer, len, query.client);
+}
+
+void serve() {
+    std::array<uint8_t, MAX_MESSAGE_SIZE> buffer;
+
+    while (!should_stop) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(server_sock, &fds);
+        FD_SET(upstream_sock, &fds);
+        timeval timeout{.tv_sec = 0, .tv_usec = POLL_INTERVAL_MS * 1000};
+
+        auto ready = select(std::max(server_sock, upstream_sock) + 1, &fds, nullptr, nullptr, &timeout);
+        if (ready < 0) {
+            ESP_LOGW(TAG, "Waiting for DNS messages failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(POLL_INTERVAL_MS));
+            continue;
+        }
+
+        if (FD_ISSET(server_sock, &fds)) handleQuery(buffer.data());
+        if (FD_ISSET(upstream_sock, &fds)) handleAnswer(buffer.data());
+
+        auto now = xTaskGetTickCount();
+        std::erase_if(pending, [&](const Pending& p) { return now - p.sent_at > PENDING_TIMEOUT; });
+    }
+
+    waitbits.set(FINISHED_BIT);
+}
+
+void closeSockets() {
+    if (server_sock >= 0) close(server_sock);
+    if (upstream_sock >= 0) close(upstream_sock);
+    server_sock = -1;
+    upstream_sock = -1;
+}
+
+}  // namespace
+
+esp_err_t start(uint32_t addr, uint32_t upstream) {
+    ESP_LOGI(TAG, "Starting DNS cache");
+
+    ESP_RETURN_ON_ERROR(waitbits.init(), TAG, "Failed to initialize DNS task waitbits");
+
+    server_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    upstream_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (server_sock < 0 || upstream_sock < 0) {
+        closeSockets();
+        ESP_LOGE(TAG, "Failed to create DNS sockets");
+        return ESP_FAIL;
+    }
+
+    // only serve the mesh, not the network of the router
+    sockaddr_in server_addr{};
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(DNS_PORT);
+    server_addr.sin_addr.s_addr = addr;
+    if (bind(server_sock, reinterpret_cast<sockaddr*>(&server_addr), sizeof(server_addr)) < 0) {
+        closeSockets();
+        ESP_LOGE(TAG, "Failed to bind DNS socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    upstream_addr = {};
+    upstream_addr.sin_family = AF_INET;
+    upstream_addr.sin_port = htons(DNS_PORT);
+    upstream_addr.sin_addr.s_addr = upstream;
+
+    should_stop = false;
+    auto ret = task.init(util::TaskSettings("dns_cache", 4096, TASK_PRIORITY, util::CPU::PRO_CPU), &serve);
+    if (ret != ESP_OK) {
+        closeSockets();
+        ESP_LOGE(TAG, "Failed to start DNS task");
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+void stop() {
+    if (server_sock < 0) return;
+
+    ESP_LOGI(TAG, "Stopping DNS cache");
+
+    should_stop = true;
+    waitbits.wait(FINISHED_BIT, true, true, portMAX_DELAY);
+    task = util::Task();
+
+    closeSockets();
+    entries.clear();
+    pending.clear();
+}
+
+Stats getStats() {
+    return Stats{
+        .queries = stats.queries,
+        .hits = stats.hits,
+        .upstream_queries = stats.upstream_queries,
+    };
+}
+
+}  // namespace meshnow::dns_cache
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <esp_err.h>
+
+#include <cstdint>
+
+namespace meshnow::dns_cache {
+
+/**
+ * Root only: a small caching DNS forwarder on the mesh interface of the root.
+ *
+ * The root advertises its own mesh address as DNS server, answers repeated queries from the cache and forwards all
+ * other queries to CONFIG_STATIC_DNS_ADDR. Cached answers expire with the lowest TTL of their records, and the TTLs
+ * handed out are reduced by the time the answer has spent in the cache.
+ */
+
+struct Stats {
+    // queries received from mesh nodes
+    uint32_t queries;
+    // queries answered from the cache
+    uint32_t hits;
+    // queries forwarded to the upstream DNS server
+    uint32_t upstream_queries;
+};
+
+/**
+ * Starts serving DNS on the given address.
+ * @param addr the address of the mesh interface of the root, in network byte order
+ * @param upstream the address of the upstream DNS server, in network byte order
+ */
+esp_err_t start(uint32_t addr, uint32_t upstream);
+
+/**
+ * Stops serving DNS and forgets all cached answers.
+ */
+void stop();
+
+Stats getStats();
+
+}  // namespace meshnow::dns_cache
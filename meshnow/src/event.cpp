@@ -1,14 +1,31 @@
 #include "event.hpp"
 
+#include <esp_check.h>
+#include <esp_log.h>
 #include <esp_task.h>
 
+#include <atomic>
+#include <cstring>
+
 #include "meshnow.h"
+#include "util/queue.hpp"
+#include "util/util.hpp"
 
 namespace meshnow::event {
 
 ESP_EVENT_DEFINE_BASE(MESHNOW_INTERNAL);
 
+static constexpr auto TAG = CREATE_TAG("Event");
+
+static constexpr auto INBOX_SIZE{16};
+
+static util::Queue<InboxMessage> inbox;
+
+static std::atomic<uint32_t> dropped_events{0};
+
 esp_err_t Internal::init() {
+    ESP_RETURN_ON_ERROR(inbox.init(INBOX_SIZE), TAG, "Failed to initialize inbox");
+
     // TODO all these values should be config values
     esp_event_loop_args_t args{
         .queue_size = 16,
@@ -24,13 +41,30 @@ void Internal::deinit() {
     assert(handle != nullptr);
     ESP_ERROR_CHECK(esp_event_loop_delete(handle));
     handle = nullptr;
+    inbox = util::Queue<InboxMessage>{};
 }
 
 void Internal::fire(meshnow::event::InternalEvent event, void* data, size_t data_size) {
+    assert(data_size <= MAX_EVENT_DATA_SIZE && "Event data too large");
+
+    InboxMessage message{.event = event, .data = {}};
+    std::memcpy(message.data.data(), data, data_size);
+    // the job runner fires most events itself, so never block on its own inbox
+    if (!inbox.push_back(std::move(message), 0)) {
+        ESP_LOGD(TAG, "Inbox full, dropping event %ld", static_cast<int32_t>(event));
+        dropped_events++;
+    }
+
     ESP_ERROR_CHECK(
         esp_event_post_to(handle, MESHNOW_INTERNAL, static_cast<int32_t>(event), data, data_size, portMAX_DELAY));
 }
 
+std::optional<InboxMessage> Internal::popInbox(TickType_t timeout) { return inbox.pop(timeout); }
+
+void Internal::clearInbox() { inbox.clear(); }
+
+uint32_t Internal::droppedEvents() { return dropped_events; }
+
 esp_event_loop_handle_t Internal::handle{nullptr};
 
 }  // namespace meshnow::event
\ No newline at end of file
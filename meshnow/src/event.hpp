@@ -2,7 +2,11 @@
 
 #include <esp_err.h>
 #include <esp_event.h>
+#include <freertos/portmacro.h>
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <optional>
 
 #include "state.hpp"
@@ -15,6 +19,7 @@ enum class InternalEvent : int32_t {
     STATE_CHANGED,
     PARENT_FOUND,
     GOT_CONNECT_RESPONSE,
+    CHILD_CONNECTED,
 };
 
 struct StateChangedEvent {
@@ -30,6 +35,25 @@ struct ParentFoundData {
 struct GotConnectResponseData {
     const util::MacAddr parent;
     const util::MacAddr root;
+    // unset if the parent replied in the v1 form
+    const std::optional<uint16_t> max_frame_size;
+};
+
+struct ChildConnectedData {
+    const util::MacAddr child;
+};
+
+/**
+ * Maximum size of the data attached to an internal event.
+ */
+constexpr size_t MAX_EVENT_DATA_SIZE{16};
+
+/**
+ * An internal event as delivered to the inbox of the job runner.
+ */
+struct InboxMessage {
+    InternalEvent event;
+    alignas(std::max_align_t) std::array<uint8_t, MAX_EVENT_DATA_SIZE> data;
 };
 
 class Internal {
@@ -44,8 +68,27 @@ class Internal {
      */
     static void deinit();
 
+    /**
+     * Fires an event. It is delivered to the inbox of the job runner and posted to the internal event loop.
+     */
     static void fire(InternalEvent event, void* data, size_t data_size);
 
+    /**
+     * Pops the next event from the inbox of the job runner.
+     * @param timeout Timeout in ticks
+     */
+    static std::optional<InboxMessage> popInbox(TickType_t timeout);
+
+    /**
+     * Discards all events in the inbox, e.g. stale ones fired before the job runner started.
+     */
+    static void clearInbox();
+
+    /**
+     * Returns the number of events that were not delivered to the job runner because its inbox was full.
+     */
+    static uint32_t droppedEvents();
+
     static esp_event_loop_handle_t handle;
 };
 
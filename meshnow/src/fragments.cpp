@@ -5,9 +5,18 @@
 #include <freertos/portmacro.h>
 #include <freertos/task.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <map>
+#include <optional>
 
 #include "constants.hpp"
+#include "header_compression.hpp"
+#include "packets.hpp"
+#include "send/queue.hpp"
+#include "state.hpp"
 #include "util/queue.hpp"
 
 namespace meshnow::fragments {
@@ -17,74 +26,205 @@ static constexpr auto TAG = CREATE_TAG("Fragments");
 static constexpr auto QUEUE_SIZE{32};
 // TODO QUEUE_SIZE has to be higher so not to get deadlocks! FIND A REAL SOLUTION!
 
-static util::Queue<util::Buffer> finished_queue;
+// owns the queued pbufs
+static util::Queue<pbuf*> finished_queue;
+
+// after this time without a new fragment, the source is asked for the missing ones
+static constexpr auto NACK_DELAY = pdMS_TO_TICKS(CONFIG_FRAGMENT_NACK_DELAY);
+
+// how often the missing fragments of a frame are requested at most
+static constexpr auto MAX_NACKS{3};
+
+static std::atomic<uint32_t> recovered_fragments;
+
+static std::atomic<uint32_t> nacks_sent;
+
+/**
+ * Allocates a pbuf for the data. Compressed frames get room in front to restore their headers in place.
+ */
+static util::PbufPtr allocate(uint16_t total_size, bool compressed) {
+    if (!compressed) return util::PbufPtr{pbuf_alloc(PBUF_RAW, total_size, PBUF_RAM)};
+
+    util::PbufPtr p{pbuf_alloc(PBUF_RAW, total_size + header_compression::HEADROOM, PBUF_RAM)};
+    if (p) pbuf_remove_header(p.get(), header_compression::HEADROOM);
+    return p;
+}
 
 /**
  * Data that is being reassembled.
  */
 class ReassemblyData {
    public:
-    explicit ReassemblyData(uint16_t total_size)
-        : data_(total_size),
+    ReassemblyData(uint16_t total_size, bool compressed)
+        : data_(allocate(total_size, compressed)),
+          compressed_(compressed),
           // rounds up to the next integer
           num_fragments((total_size + MAX_FRAG_PAYLOAD_SIZE - 1) / MAX_FRAG_PAYLOAD_SIZE) {
-        // reserve buffer beforehand
-        ESP_LOGV(TAG, "Reserving %d bytes for reassembly", total_size);
-        data_.reserve(total_size);
+        ESP_LOGV(TAG, "Allocated %d bytes for reassembly", total_size);
     }
 
-    void insert(uint8_t frag_num, const util::Buffer& data) {
+    /**
+     * False if the pbuf could not be allocated.
+     */
+    bool isValid() const noexcept { return data_ != nullptr; }
+
+    void insert(uint8_t frag_num, bool large, const util::Buffer& data) {
         ESP_LOG_BUFFER_HEXDUMP(TAG, data.data(), data.size(), ESP_LOG_VERBOSE);
-        // set bit to indicate this fragment was received
-        fragment_mask |= 1 << frag_num;
-        // copy to the correct position
-        std::copy(data.begin(), data.end(), data_.begin() + MAX_FRAG_PAYLOAD_SIZE * frag_num);
-        // update time
         last_fragment_received_ = xTaskGetTickCount();
+        next_nack_at_ = last_fragment_received_ + NACK_DELAY;
+
+        if (frag_num == PARITY_FRAG_NUM) {
+            // parity is only computed over regular fragments
+            if (large || data.size() != std::min<size_t>(MAX_FRAG_PAYLOAD_SIZE, data_->tot_len)) return;
+            parity_ = data;
+            recover();
+            return;
+        }
+
+        // copy to the correct position, fails if it does not fit
+        if (pbuf_take_at(data_.get(), data.data(), data.size(), packets::fragmentUnit(large) * frag_num) != ERR_OK) {
+            ESP_LOGW(TAG, "Fragment %d does not fit into the reassembly buffer", frag_num);
+            return;
+        }
+        // set bits to indicate which regular fragments were received, a large one covers several at once
+        auto units = large ? LARGE_FRAG_UNITS : 1;
+        for (int i = frag_num * units; i < (frag_num + 1) * units && i < num_fragments; ++i) {
+            fragment_mask |= 1 << i;
+        }
+        recover();
     }
 
     bool isComplete() const noexcept { return fragment_mask == (1 << num_fragments) - 1; }
 
-    util::Buffer getData() noexcept { return data_; }
+    util::PbufPtr takeData() noexcept { return std::move(data_); }
+
+    bool isCompressed() const noexcept { return compressed_; }
 
     TickType_t lastFragmentReceived() const noexcept { return last_fragment_received_; }
 
+    /**
+     * Each bit of the returned mask corresponds to a regular fragment that has not arrived yet.
+     */
+    uint8_t missing() const noexcept { return ~fragment_mask & ((1 << num_fragments) - 1); }
+
+    /**
+     * Returns when to request the missing fragments, or portMAX_DELAY if not anymore.
+     */
+    TickType_t nextNackAt() const noexcept { return nacks_left_ > 0 ? next_nack_at_ : portMAX_DELAY; }
+
+    void nackSent(TickType_t now) noexcept {
+        nacks_left_--;
+        // give the resent fragments time to travel back before asking again
+        next_nack_at_ = now + 2 * NACK_DELAY;
+    }
+
    private:
+    /**
+     * Restores the missing data from the parity if only a single regular fragment is missing.
+     */
+    void recover() {
+        if (parity_.empty() || isComplete()) return;
+
+        uint8_t missing = this->missing();
+        if (std::popcount(missing) != 1) return;
+        int stripe = __builtin_ctz(missing);
+
+        // the XOR of the parity and all other fragments is the missing one
+        auto unit = MAX_FRAG_PAYLOAD_SIZE;
+        auto* data = static_cast<uint8_t*>(data_->payload);
+        size_t begin = stripe * unit;
+        for (size_t i = 0; i < data_->tot_len; ++i) {
+            if (i < begin || i >= begin + unit) parity_[i % unit] ^= data[i];
+        }
+        auto size = std::min<size_t>(unit, data_->tot_len - begin);
+        std::copy_n(parity_.begin(), size, data + begin);
+
+        fragment_mask |= missing;
+        parity_.clear();
+        recovered_fragments++;
+        ESP_LOGD(TAG, "Recovered fragment %d from parity", stripe);
+    }
+
     // Reassembled data
-    util::Buffer data_;
+    util::PbufPtr data_;
+
+    // Whether the data has compressed headers
+    bool compressed_;
 
     // Number of fragments that are expected.
     uint8_t num_fragments;
 
-    // Each bit in the mask corresponds to a fragment. If the bit is set, the fragment was received.
-    uint8_t fragment_mask{0};
+    // Each bit in the mask corresponds to a regular fragment. If the bit is set, the fragment was received.
+    uint16_t fragment_mask{0};
 
     // When the last fragment was received in ticks since boot.
     TickType_t last_fragment_received_{0};
+
+    // XOR of all fragments, kept until the data is complete
+    util::Buffer parity_;
+
+    // When to request the missing fragments from the source
+    TickType_t next_nack_at_{0};
+
+    // How often the missing fragments may still be requested
+    uint8_t nacks_left_{NACK_DELAY > 0 ? MAX_NACKS : 0};
 };
 
 /**
  * "Uniquely" identifies a data entry with a source MAC address and a fragment ID.
  */
-using ReassemblyKey = std::pair<util::MacAddr, uint16_t>;
+using ReassemblyKey = std::pair<util::MacAddr, uint32_t>;
 
 static std::map<ReassemblyKey, ReassemblyData> reassembly_map;
 
+// recently completed data, so that late or resent duplicates of its fragments don't start a new reassembly
+static std::array<std::optional<ReassemblyKey>, 8> completed;
+static size_t completed_next{0};
+
+static bool isCompleted(const ReassemblyKey& key) {
+    return std::find(completed.begin(), completed.end(), key) != completed.end();
+}
+
+static void markCompleted(const ReassemblyKey& key) {
+    completed[completed_next] = key;
+    completed_next = (completed_next + 1) % completed.size();
+}
+
 esp_err_t init() { return finished_queue.init(QUEUE_SIZE); }
 
 void deinit() {
     reassembly_map.clear();
-    finished_queue = util::Queue<util::Buffer>{};
+    completed.fill(std::nullopt);
+    // free data nobody picked up anymore
+    while (auto p = finished_queue.pop(0)) {
+        pbuf_free(*p);
+    }
+    finished_queue = util::Queue<pbuf*>{};
+}
+
+static void pushFinished(const util::MacAddr& src_mac, util::PbufPtr data, bool compressed) {
+    // restore compressed headers before the data reaches the stack
+    if (compressed && !header_compression::decompress(src_mac, data.get())) {
+        ESP_LOGD(TAG, "Dropping frame with unknown compressed headers");
+        return;
+    }
+    finished_queue.push_back(data.release(), portMAX_DELAY);
 }
 
-void addFragment(const util::MacAddr& src_mac, uint16_t fragment_id, uint16_t fragment_number, uint16_t total_size,
-                 util::Buffer data) {
+void addFragment(const util::MacAddr& src_mac, uint32_t fragment_id, uint16_t fragment_number, uint16_t total_size,
+                 bool large, bool compressed, const util::Buffer& data) {
     ESP_LOGV(TAG, "Received fragment %d from message %d with size %d/%d", fragment_number, fragment_id, data.size(),
              total_size);
 
     // short-circuit logic if it is the first and only fragment
     if (fragment_number == 0 && total_size == data.size()) {
-        finished_queue.push_back(std::move(data), portMAX_DELAY);
+        auto p = allocate(total_size, compressed);
+        if (!p) {
+            ESP_LOGW(TAG, "Out of memory, dropping message %d", fragment_id);
+            return;
+        }
+        pbuf_take(p.get(), data.data(), data.size());
+        pushFinished(src_mac, std::move(p), compressed);
         return;
     }
 
@@ -93,25 +233,38 @@ void addFragment(const util::MacAddr& src_mac, uint16_t fragment_id, uint16_t fr
     // check if we already have an entry for this fragment
     auto it = reassembly_map.find(key);
     if (it == reassembly_map.end()) {
+        // the parity is sent last, so without an entry the data is most likely complete already
+        if (fragment_number == PARITY_FRAG_NUM || isCompleted(key)) return;
+
         // no entry yet, create one
-        auto entry = ReassemblyData{total_size};
-        entry.insert(fragment_number, data);
+        auto entry = ReassemblyData{total_size, compressed};
+        if (!entry.isValid()) {
+            ESP_LOGW(TAG, "Out of memory, dropping message %d", fragment_id);
+            return;
+        }
+        entry.insert(fragment_number, large, data);
         reassembly_map.emplace(key, std::move(entry));
         return;
     }
 
     // entry already exists, add the fragment
-    it->second.insert(fragment_number, data);
+    it->second.insert(fragment_number, large, data);
 
     // check if the data is complete
     if (it->second.isComplete()) {
         // data is complete, move it to the finished queue
-        finished_queue.push_back(it->second.getData(), portMAX_DELAY);
+        pushFinished(src_mac, it->second.takeData(), it->second.isCompressed());
         reassembly_map.erase(it);
+        markCompleted(key);
     }
 }
 
-std::optional<util::Buffer> popReassembledData(TickType_t timeout) { return finished_queue.pop(timeout); }
+uint32_t recoveredFragments() { return recovered_fragments; }
+
+util::PbufPtr popReassembledData(TickType_t timeout) {
+    auto p = finished_queue.pop(timeout);
+    return util::PbufPtr{p.value_or(nullptr)};
+}
 
 TickType_t youngestFragmentTime() {
     // if empty return max time
@@ -126,6 +279,29 @@ TickType_t youngestFragmentTime() {
     return youngest->second.lastFragmentReceived();
 }
 
+TickType_t nextNackTime() {
+    TickType_t next = portMAX_DELAY;
+    for (const auto& [key, entry] : reassembly_map) {
+        next = std::min(next, entry.nextNackAt());
+    }
+    return next;
+}
+
+void requestMissing(TickType_t now) {
+    for (auto& [key, entry] : reassembly_map) {
+        if (entry.nextNackAt() > now) continue;
+
+        auto& [src_mac, fragment_id] = key;
+        ESP_LOGD(TAG, "Requesting fragments 0x%02x of message %lu", entry.missing(), fragment_id);
+        send::enqueuePayload(packets::FragmentNack{fragment_id, entry.missing()},
+                             send::FullyResolve(state::getThisMac(), src_mac, state::getThisMac()));
+        entry.nackSent(now);
+        nacks_sent++;
+    }
+}
+
+uint32_t nacksSent() { return nacks_sent; }
+
 void removeOlderThan(TickType_t time) {
     for (auto it = reassembly_map.begin(); it != reassembly_map.end();) {
         if (it->second.lastFragmentReceived() < time) {
@@ -3,9 +3,9 @@
 #include <freertos/portmacro.h>
 
 #include <cstdint>
-#include <optional>
 
 #include "util/mac.hpp"
+#include "util/pbuf.hpp"
 #include "util/util.hpp"
 
 namespace meshnow::fragments {
@@ -25,19 +25,27 @@ void deinit();
  *
  * @param src_mac MAC of the node the fragment originated from
  * @param fragment_id Random ID to identify which fragments belong together
- * @param fragment_number Number of this fragment in the sequence of fragments [0, 7]
+ * @param fragment_number Number of this fragment in the sequence of fragments [0, 6], or PARITY_FRAG_NUM
  * @param total_size Total size of the data over all fragments in bytes [0, 1500]
+ * @param large Whether the fragment number counts in large fragments
+ * @param compressed Whether the data is an IP frame with compressed headers, which are restored after reassembly
  * @param data Data of this fragment
  */
-void addFragment(const util::MacAddr& src_mac, uint16_t fragment_id, uint16_t fragment_number, uint16_t total_size,
-                 util::Buffer data);
+void addFragment(const util::MacAddr& src_mac, uint32_t fragment_id, uint16_t fragment_number, uint16_t total_size,
+                 bool large, bool compressed, const util::Buffer& data);
 
 /**
  * Return the next reassembled data.
+ * The data is reassembled directly into a single pbuf allocated when the first fragment arrives.
  * @param timeout Timeout to wait for data
- * @return Reassembled data or std::nullopt if no data was received
+ * @return Reassembled data or nullptr if no data was received
  */
-std::optional<util::Buffer> popReassembledData(TickType_t timeout);
+util::PbufPtr popReassembledData(TickType_t timeout);
+
+/**
+ * Returns how often a lost fragment was restored from the parity fragment.
+ */
+uint32_t recoveredFragments();
 
 /**
  * Return the time of the youngest fragment.
@@ -50,4 +58,20 @@ TickType_t youngestFragmentTime();
  */
 void removeOlderThan(TickType_t time);
 
+/**
+ * Return when the missing fragments of an incomplete reassembly are to be requested next.
+ * @return Time of the next request, or portMAX_DELAY if none is due
+ */
+TickType_t nextNackTime();
+
+/**
+ * Ask the sources of all incomplete reassemblies without a new fragment for a while to resend the missing fragments.
+ */
+void requestMissing(TickType_t now);
+
+/**
+ * Returns how often missing fragments were requested.
+ */
+uint32_t nacksSent();
+
 }  // namespace meshnow::fragments
\ No newline at end of file
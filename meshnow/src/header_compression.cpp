@@ -0,0 +1,410 @@
+#include "header_compression.hpp"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "packets.hpp"
+#include "send/queue.hpp"
+#include "state.hpp"
+#include "util/mutex.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::header_compression {
+
+static constexpr auto TAG = CREATE_TAG("HeaderCompression");
+
+// flows per peer, the flow ID is sent in the lower bits of the first byte
+static constexpr size_t MAX_FLOWS{8};
+
+// the full header is resent after this many compressed frames to recover from unnoticed losses
+static constexpr uint8_t REFRESH_INTERVAL{32};
+
+// first byte of a compressed frame: flag and flow ID
+static constexpr uint8_t COMPRESSED_FLAG{0x80};
+static constexpr uint8_t FLOW_ID_MASK{0x0F};
+
+// prefix of a frame carrying a full header: flow ID and generation
+static constexpr size_t FULL_PREFIX_SIZE{2};
+
+// bits of the change mask in a compressed frame
+static constexpr uint8_t WINDOW_PRESENT{0x01};
+static constexpr uint8_t TCP_FLAGS_PRESENT{0x02};
+
+// offsets into the full header
+namespace offset {
+constexpr size_t ETH_TYPE{12};
+constexpr size_t IP{14};
+constexpr size_t IP_VERSION_IHL{IP + 0};
+constexpr size_t IP_TOTAL_LEN{IP + 2};
+constexpr size_t IP_ID{IP + 4};
+constexpr size_t IP_FRAG{IP + 6};
+constexpr size_t IP_PROTO{IP + 9};
+constexpr size_t IP_CHECKSUM{IP + 10};
+constexpr size_t IP_ADDRS{IP + 12};
+constexpr size_t TCP{IP + 20};
+constexpr size_t TCP_SEQ{TCP + 4};
+constexpr size_t TCP_ACK{TCP + 8};
+constexpr size_t TCP_DATA_OFFSET{TCP + 12};
+constexpr size_t TCP_FLAGS{TCP + 13};
+constexpr size_t TCP_WINDOW{TCP + 14};
+constexpr size_t TCP_CHECKSUM{TCP + 16};
+constexpr size_t TCP_URGENT{TCP + 18};
+}  // namespace offset
+
+using Header = std::array<uint8_t, FULL_HEADER_SIZE>;
+
+// HELPERS //
+
+static uint16_t get16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+
+static uint32_t get32(const uint8_t* p) { return (static_cast<uint32_t>(get16(p)) << 16) | get16(p + 2); }
+
+static void put16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    put16(p, v >> 16);
+    put16(p + 2, v);
+}
+
+static size_t putVarint(uint8_t* p, uint32_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static bool getVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t byte = *p++;
+        v |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint16_t ipChecksum(const uint8_t* ip_header) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < 20; i += 2) {
+        if (i == 10) continue;  // the checksum itself
+        sum += get16(ip_header + i);
+    }
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return ~sum;
+}
+
+/**
+ * Only IPv4/TCP frames without options, fragmentation and urgent data can be compressed.
+ */
+static bool isCompressible(const Header& h, size_t frame_len) {
+    return get16(&h[offset::ETH_TYPE]) == 0x0800 && h[offset::IP_VERSION_IHL] == 0x45 && h[offset::IP_PROTO] == 6 &&
+           (get16(&h[offset::IP_FRAG]) & 0x3FFF) == 0 && get16(&h[offset::IP_TOTAL_LEN]) == frame_len - offset::IP &&
+           (h[offset::TCP_DATA_OFFSET] >> 4) == 5 && get16(&h[offset::TCP_URGENT]) == 0;
+}
+
+/**
+ * Returns true iff both headers belong to the same flow: same Ethernet header, addresses and ports.
+ */
+static bool sameFlow(const Header& a, const Header& b) {
+    return std::equal(a.begin(), a.begin() + offset::IP, b.begin()) &&
+           std::equal(a.begin() + offset::IP_ADDRS, a.begin() + offset::TCP_SEQ, b.begin() + offset::IP_ADDRS);
+}
+
+/**
+ * Returns true iff the fields that are never sent in compressed frames are the same.
+ */
+static bool sameStaticFields(const Header& a, const Header& b) {
+    // version, IHL, TOS
+    if (!std::equal(a.begin() + offset::IP, a.begin() + offset::IP_TOTAL_LEN, b.begin() + offset::IP)) return false;
+    // fragmentation flags, TTL, protocol
+    if (!std::equal(a.begin() + offset::IP_FRAG, a.begin() + offset::IP_CHECKSUM, b.begin() + offset::IP_FRAG)) {
+        return false;
+    }
+    return a[offset::TCP_DATA_OFFSET] == b[offset::TCP_DATA_OFFSET];
+}
+
+// STATE //
+
+namespace {
+
+struct CompressorFlow {
+    Header reference;
+    uint8_t generation{0};
+    uint8_t since_refresh{0};
+    // false if the next frame must carry the full header
+    bool valid{false};
+    bool used{false};
+    TickType_t last_used{0};
+};
+
+struct DecompressorFlow {
+    Header reference;
+    uint8_t generation{0};
+    bool valid{false};
+    // the peer was already asked to resend the reference
+    bool resync_requested{false};
+};
+
+template <typename Flow>
+struct Peer {
+    util::MacAddr mac;
+    std::array<Flow, MAX_FLOWS> flows;
+};
+
+util::Mutex mutex;
+
+std::vector<Peer<CompressorFlow>> compressors;
+
+std::vector<Peer<DecompressorFlow>> decompressors;
+
+struct {
+    std::atomic<uint32_t> compressed_frames;
+    std::atomic<uint32_t> bytes_saved;
+    std::atomic<uint32_t> resyncs;
+} stats;
+
+}  // namespace
+
+template <typename Flow>
+static Peer<Flow>& getOrCreate(std::vector<Peer<Flow>>& peers, const util::MacAddr& mac) {
+    auto it = std::find_if(peers.begin(), peers.end(), [&](const auto& peer) { return peer.mac == mac; });
+    if (it != peers.end()) return *it;
+    return peers.emplace_back(Peer<Flow>{mac, {}});
+}
+
+/**
+ * Finds the flow of the header or replaces the least recently used one.
+ */
+static uint8_t findFlow(Peer<CompressorFlow>& peer, const Header& header) {
+    auto& flows = peer.flows;
+    auto it = std::find_if(flows.begin(), flows.end(),
+                           [&](const CompressorFlow& flow) { return flow.used && sameFlow(flow.reference, header); });
+    if (it != flows.end()) return it - flows.begin();
+
+    it = std::min_element(flows.begin(), flows.end(), [](const CompressorFlow& a, const CompressorFlow& b) {
+        if (a.used != b.used) return !a.used;
+        return a.last_used < b.last_used;
+    });
+    it->used = true;
+    it->valid = false;
+    it->reference = header;
+    return it - flows.begin();
+}
+
+// COMPRESSION //
+
+util::PbufPtr compress(const util::MacAddr& peer_mac, const pbuf* frame) {
+#if CONFIG_HEADER_COMPRESSION
+    if (frame->tot_len < FULL_HEADER_SIZE) return nullptr;
+
+    Header header;
+    pbuf_copy_partial(frame, header.data(), header.size(), 0);
+    if (!isCompressible(header, frame->tot_len)) return nullptr;
+
+    std::lock_guard lock{mutex};
+
+    auto& peer = getOrCreate(compressors, peer_mac);
+    auto flow_id = findFlow(peer, header);
+    auto& flow = peer.flows[flow_id];
+    flow.last_used = xTaskGetTickCount();
+
+    size_t payload_len = frame->tot_len - FULL_HEADER_SIZE;
+
+    bool send_full =
+        !flow.valid || flow.since_refresh >= REFRESH_INTERVAL || !sameStaticFields(flow.reference, header);
+    if (send_full) {
+        // new reference, the frame is sent as is behind the flow ID and the new generation
+        flow.reference = header;
+        flow.generation++;
+        flow.since_refresh = 0;
+        flow.valid = true;
+
+        util::PbufPtr out{pbuf_alloc(PBUF_RAW, FULL_PREFIX_SIZE + frame->tot_len, PBUF_RAM)};
+        if (!out) return nullptr;
+        auto* data = static_cast<uint8_t*>(out->payload);
+        data[0] = flow_id;
+        data[1] = flow.generation;
+        pbuf_copy_partial(frame, data + FULL_PREFIX_SIZE, frame->tot_len, 0);
+        return out;
+    }
+
+    // encode the differences to the reference
+    std::array<uint8_t, 3 + 3 * 5 + 2 + 1 + 2> compressed;
+    auto* p = compressed.data();
+    *p++ = COMPRESSED_FLAG | flow_id;
+    *p++ = flow.generation;
+    auto* mask = p++;
+    *mask = 0;
+
+    auto& ref = flow.reference;
+    p += putVarint(p, static_cast<uint16_t>(get16(&header[offset::IP_ID]) - get16(&ref[offset::IP_ID])));
+    p += putVarint(p, get32(&header[offset::TCP_SEQ]) - get32(&ref[offset::TCP_SEQ]));
+    p += putVarint(p, get32(&header[offset::TCP_ACK]) - get32(&ref[offset::TCP_ACK]));
+    if (get16(&header[offset::TCP_WINDOW]) != get16(&ref[offset::TCP_WINDOW])) {
+        *mask |= WINDOW_PRESENT;
+        put16(p, get16(&header[offset::TCP_WINDOW]));
+        p += 2;
+    }
+    if (header[offset::TCP_FLAGS] != ref[offset::TCP_FLAGS]) {
+        *mask |= TCP_FLAGS_PRESENT;
+        *p++ = header[offset::TCP_FLAGS];
+    }
+    // the TCP checksum protects the data end-to-end, so it is always sent
+    put16(p, get16(&header[offset::TCP_CHECKSUM]));
+    p += 2;
+
+    size_t compressed_len = p - compressed.data();
+    util::PbufPtr out{pbuf_alloc(PBUF_RAW, compressed_len + payload_len, PBUF_RAM)};
+    if (!out) return nullptr;
+    auto* data = static_cast<uint8_t*>(out->payload);
+    std::memcpy(data, compressed.data(), compressed_len);
+    pbuf_copy_partial(frame, data + compressed_len, payload_len, FULL_HEADER_SIZE);
+
+    flow.since_refresh++;
+    stats.compressed_frames++;
+    stats.bytes_saved += FULL_HEADER_SIZE - compressed_len;
+    return out;
+#else
+    return nullptr;
+#endif
+}
+
+bool carriesReference(const pbuf* frame) {
+    return !(static_cast<const uint8_t*>(frame->payload)[0] & COMPRESSED_FLAG);
+}
+
+uint8_t generationOf(const pbuf* frame) { return static_cast<const uint8_t*>(frame->payload)[1]; }
+
+// DECOMPRESSION //
+
+static void requestResync(const util::MacAddr& peer_mac, uint8_t flow_id) {
+    ESP_LOGD(TAG, "Requesting header resync of flow %d from " MACSTR, flow_id, MAC2STR(peer_mac));
+    send::enqueuePayload(packets::CompressionNack{flow_id},
+                         send::FullyResolve(state::getThisMac(), peer_mac, state::getThisMac()));
+}
+
+static bool decompressFull(DecompressorFlow& flow, pbuf* frame, uint8_t generation) {
+    pbuf_remove_header(frame, FULL_PREFIX_SIZE);
+
+    Header header;
+    if (frame->tot_len < FULL_HEADER_SIZE) return false;
+    pbuf_copy_partial(frame, header.data(), header.size(), 0);
+
+    flow.reference = header;
+    flow.generation = generation;
+    flow.valid = true;
+    flow.resync_requested = false;
+    return true;
+}
+
+static bool decompressDelta(DecompressorFlow& flow, pbuf* frame) {
+    const auto* begin = static_cast<const uint8_t*>(frame->payload);
+    const auto* end = begin + frame->len;
+    const auto* p = begin + 2;
+    if (p >= end) return false;
+    uint8_t mask = *p++;
+
+    uint32_t ip_id_delta, seq_delta, ack_delta;
+    if (!getVarint(p, end, ip_id_delta) || !getVarint(p, end, seq_delta) || !getVarint(p, end, ack_delta)) {
+        return false;
+    }
+
+    auto header = flow.reference;
+    put16(&header[offset::IP_ID], get16(&header[offset::IP_ID]) + ip_id_delta);
+    put32(&header[offset::TCP_SEQ], get32(&header[offset::TCP_SEQ]) + seq_delta);
+    put32(&header[offset::TCP_ACK], get32(&header[offset::TCP_ACK]) + ack_delta);
+
+    if (mask & WINDOW_PRESENT) {
+        if (end - p < 2) return false;
+        std::copy(p, p + 2, &header[offset::TCP_WINDOW]);
+        p += 2;
+    }
+    if (mask & TCP_FLAGS_PRESENT) {
+        if (end - p < 1) return false;
+        header[offset::TCP_FLAGS] = *p++;
+    }
+    if (end - p < 2) return false;
+    std::copy(p, p + 2, &header[offset::TCP_CHECKSUM]);
+    p += 2;
+
+    // swap the compressed header for the full one, the reassembly left enough room in front
+    pbuf_remove_header(frame, p - begin);
+    if (pbuf_add_header(frame, FULL_HEADER_SIZE) != 0) return false;
+
+    put16(&header[offset::IP_TOTAL_LEN], frame->tot_len - offset::IP);
+    put16(&header[offset::IP_CHECKSUM], ipChecksum(&header[offset::IP]));
+    pbuf_take(frame, header.data(), header.size());
+    return true;
+}
+
+bool decompress(const util::MacAddr& peer_mac, pbuf* frame) {
+    if (frame->len < FULL_PREFIX_SIZE || frame->len != frame->tot_len) return false;
+
+    const auto* data = static_cast<const uint8_t*>(frame->payload);
+    uint8_t flow_id = data[0] & FLOW_ID_MASK;
+    uint8_t generation = data[1];
+    if (flow_id >= MAX_FLOWS) return false;
+
+    {
+        std::lock_guard lock{mutex};
+
+        auto& flow = getOrCreate(decompressors, peer_mac).flows[flow_id];
+
+        if (!(data[0] & COMPRESSED_FLAG)) return decompressFull(flow, frame, generation);
+
+        if (flow.valid && flow.generation == generation) return decompressDelta(flow, frame);
+
+        // the reference this frame was compressed against never arrived
+        // one request per reference is enough, the periodic refresh covers lost requests
+        if (flow.resync_requested) return false;
+        flow.resync_requested = true;
+    }
+
+    requestResync(peer_mac, flow_id);
+    return false;
+}
+
+void resync(const util::MacAddr& peer_mac, uint8_t flow_id) {
+    if (flow_id >= MAX_FLOWS) return;
+
+    // the root addresses the nodes by their MAC, but nodes always compress towards the root address
+    auto mac = state::isRoot() ? peer_mac : util::MacAddr::root();
+
+    std::lock_guard lock{mutex};
+    auto it = std::find_if(compressors.begin(), compressors.end(), [&](const auto& peer) { return peer.mac == mac; });
+    if (it == compressors.end()) return;
+
+    it->flows[flow_id].valid = false;
+    stats.resyncs++;
+}
+
+void reset() {
+    std::lock_guard lock{mutex};
+    compressors.clear();
+    decompressors.clear();
+}
+
+Stats getStats() {
+    return Stats{
+        .compressed_frames = stats.compressed_frames,
+        .bytes_saved = stats.bytes_saved,
+        .resyncs = stats.resyncs,
+    };
+}
+
+}  // namespace meshnow::header_compression
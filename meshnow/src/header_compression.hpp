@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "util/mac.hpp"
+#include "util/pbuf.hpp"
+
+namespace meshnow::header_compression {
+
+/**
+ * Stateful compression of the Ethernet, IPv4 and TCP headers of IP frames between two mesh endpoints.
+ *
+ * For every TCP flow towards a peer, both sides keep the last full header as a reference. Frames of the flow are then
+ * sent with only the fields that differ from the reference, encoded as deltas. The reference is refreshed periodically
+ * and whenever the receiving side reports that it does not know it (e.g. after a lost frame), so a loss never corrupts
+ * more than the frames until the next refresh.
+ */
+
+// Ethernet, IPv4 and TCP headers without options
+constexpr size_t FULL_HEADER_SIZE{14 + 20 + 20};
+
+// space needed in front of a compressed frame to decompress it in place
+constexpr size_t HEADROOM{FULL_HEADER_SIZE};
+
+struct Stats {
+    // frames sent with compressed headers
+    uint32_t compressed_frames;
+    // header bytes saved by the compressed frames
+    uint32_t bytes_saved;
+    // references resent after the peer failed to decompress a frame
+    uint32_t resyncs;
+};
+
+/**
+ * Compresses the headers of an outgoing frame for the given peer.
+ * @return the compressed frame, or nullptr if the frame has to be sent as is
+ */
+util::PbufPtr compress(const util::MacAddr& peer, const pbuf* frame);
+
+/**
+ * Returns true iff the given compressed frame carries the full header, which the following frames of its flow refer to.
+ */
+bool carriesReference(const pbuf* frame);
+
+/**
+ * Returns the generation of the reference the given compressed frame refers to or carries.
+ */
+uint8_t generationOf(const pbuf* frame);
+
+/**
+ * Restores the headers of a compressed frame from the given peer in place.
+ * The frame must have HEADROOM bytes of space in front of its payload.
+ * If the reference of the flow is unknown or outdated, the peer is asked to resend it.
+ * @return false if the frame could not be decompressed and has to be dropped
+ */
+bool decompress(const util::MacAddr& peer, pbuf* frame);
+
+/**
+ * Called when the peer failed to decompress a frame of the given flow, so the next frame carries the full header.
+ */
+void resync(const util::MacAddr& peer, uint8_t flow_id);
+
+/**
+ * Forgets all flows.
+ */
+void reset();
+
+Stats getStats();
+
+}  // namespace meshnow::header_compression
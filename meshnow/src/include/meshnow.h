@@ -119,6 +119,319 @@ typedef struct {
     meshnow_router_config_t router_config;
 } meshnow_config_t;
 
+/**
+ * Classes that frames are scheduled in, from lowest to highest.
+ */
+typedef enum {
+    MESHNOW_PRIORITY_BULK,
+    MESHNOW_PRIORITY_BEST_EFFORT,
+    MESHNOW_PRIORITY_INTERACTIVE,
+    MESHNOW_PRIORITY_CONTROL,
+    MESHNOW_PRIORITY_MAX,
+} meshnow_priority_t;
+
+/**
+ * Send statistics of this node.
+ */
+typedef struct {
+    /**
+     * Number of frames handed to the ESP-NOW driver.
+     */
+    uint32_t frames_sent;
+
+    /**
+     * Number of frames the ESP-NOW driver refused to accept.
+     */
+    uint32_t frames_dropped;
+
+    /**
+     * Number of frames the ESP-NOW driver reported as failed to deliver.
+     */
+    uint32_t frames_failed;
+
+    /**
+     * Number of frames for which the ESP-NOW driver never reported a result.
+     */
+    uint32_t completions_lost;
+
+    /**
+     * Number of frames handed to the ESP-NOW driver during the last second.
+     */
+    uint32_t frames_per_second;
+
+    /**
+     * Number of frames that carried more than one aggregated small packet.
+     */
+    uint32_t aggregate_frames;
+
+    /**
+     * Number of small packets sent inside aggregate frames.
+     * The difference to aggregate_frames is the number of frames saved by aggregation.
+     */
+    uint32_t aggregated_packets;
+
+    /**
+     * Average time in milliseconds the oldest packet of an aggregate frame was held back.
+     */
+    uint32_t aggregation_delay_ms;
+
+    /**
+     * Number of frames sent with a compact header, each saving 12 bytes compared to a full header.
+     */
+    uint32_t compact_frames;
+
+    /**
+     * Number of IP frames sent with compressed TCP/IP headers.
+     */
+    uint32_t compressed_ip_frames;
+
+    /**
+     * Number of header bytes saved by TCP/IP header compression.
+     */
+    uint32_t compression_bytes_saved;
+
+    /**
+     * Number of times a peer failed to decompress a frame and the full headers had to be resent.
+     */
+    uint32_t compression_resyncs;
+
+    /**
+     * Number of queued pure TCP ACKs that were replaced by a newer ACK of the same flow instead of being sent.
+     */
+    uint32_t acks_superseded;
+
+    /**
+     * Number of parity fragments added to IP frames sent over lossy links.
+     */
+    uint32_t parity_fragments;
+
+    /**
+     * Number of queued frames that were replaced by a frame of a higher class because the queue was full.
+     */
+    uint32_t frames_evicted;
+
+    /**
+     * Number of queued frames dropped because IP traffic was waiting longer than CONFIG_CODEL_TARGET_MS.
+     */
+    uint32_t frames_delay_dropped;
+
+    /**
+     * Number of IP frames and forwarded fragments dropped because they waited in the send queue for so long that their
+     * destination would have given up on them.
+     */
+    uint32_t frames_expired;
+
+    /**
+     * Number of queued frames dropped because their next hop disconnected.
+     */
+    uint32_t frames_neighbor_gone;
+
+    /**
+     * Number of status and root reachability packets that were merged with a queued one for the same destination, so
+     * only the newest state is sent.
+     */
+    uint32_t control_coalesced;
+
+    /**
+     * Number of packets dropped because the send queue was full while they were enqueued under the lock of MeshNOW,
+     * which the send worker needs to empty it. Control packets are sent again periodically.
+     */
+    uint32_t items_dropped;
+
+    /**
+     * Median and 99th percentile of the time in milliseconds that frames waited in the queue of their next hop, indexed
+     * by meshnow_priority_t. Rounded up to one less than a power of two.
+     */
+    uint32_t queue_delay_p50_ms[MESHNOW_PRIORITY_MAX];
+    uint32_t queue_delay_p99_ms[MESHNOW_PRIORITY_MAX];
+
+    /**
+     * Number of received IP frames whose lost fragment was restored from the parity fragment.
+     */
+    uint32_t fragments_recovered;
+
+    /**
+     * Number of times the missing fragments of an incomplete IP frame were requested from its source.
+     */
+    uint32_t fragment_nacks;
+
+    /**
+     * Number of times missing fragments were resent on request of the destination.
+     */
+    uint32_t fragment_resends;
+} meshnow_send_stats_t;
+
+/**
+ * DNS cache statistics of the root.
+ */
+typedef struct {
+    /**
+     * Number of DNS lookups received from the nodes.
+     */
+    uint32_t queries;
+
+    /**
+     * Number of DNS lookups answered from the cache of the root.
+     */
+    uint32_t cache_hits;
+
+    /**
+     * Number of DNS lookups forwarded to the upstream DNS server.
+     */
+    uint32_t upstream_queries;
+} meshnow_dns_cache_stats_t;
+
+/**
+ * Statistics of the TCP proxy of the root.
+ */
+typedef struct {
+    /**
+     * Number of TCP connections of the nodes that were split by the root.
+     */
+    uint32_t connections;
+
+    /**
+     * Number of bytes the root relayed from the nodes to the internet on split TCP connections.
+     */
+    uint32_t bytes_up;
+
+    /**
+     * Number of bytes the root relayed from the internet to the nodes on split TCP connections.
+     */
+    uint32_t bytes_down;
+} meshnow_tcp_proxy_stats_t;
+
+/**
+ * Statistics of the parent changes of this node and, on the root, of the nodes below it.
+ */
+typedef struct {
+    /**
+     * Number of times this node reached the root again within the handover grace period and kept its IP address.
+     */
+    uint32_t ip_handovers;
+
+    /**
+     * How long the root was unreachable during the last handover of this node, in milliseconds.
+     */
+    uint32_t ip_handover_outage_ms;
+
+    /**
+     * Root only: number of IP frames held back for a node that was changing its parent.
+     */
+    uint32_t frames_parked;
+
+    /**
+     * Root only: number of held back IP frames that were sent once their node was reachable again.
+     */
+    uint32_t parked_frames_delivered;
+} meshnow_handover_stats_t;
+
+/**
+ * Statistics of how this node handled ARP requests and other IP broadcasts.
+ */
+typedef struct {
+    /**
+     * Number of IP frames sent to every node, e.g. unanswered ARP requests of the root.
+     */
+    uint32_t ip_broadcasts;
+
+    /**
+     * Number of ARP requests the root answered itself instead of asking the mesh.
+     */
+    uint32_t arp_replies_proxied;
+
+    /**
+     * Number of IP broadcasts that were dropped because no node needs them, or only sent towards the node that does.
+     */
+    uint32_t broadcasts_suppressed;
+} meshnow_broadcast_stats_t;
+
+/**
+ * Statistics of the internal queues of this node, which drop what does not fit instead of blocking.
+ */
+typedef struct {
+    /**
+     * Number of internal events that the job runner missed because its inbox was full.
+     */
+    uint32_t events_dropped;
+
+    /**
+     * Number of received control packets dropped because the queue of the job runner was full.
+     */
+    uint32_t control_packets_dropped;
+
+    /**
+     * Number of received data fragments and packets to forward dropped because the queue of the data plane was full.
+     */
+    uint32_t data_packets_dropped;
+} meshnow_queue_stats_t;
+
+/**
+ * Link statistics towards a neighbor (parent or direct child).
+ */
+typedef struct {
+    /**
+     * Number of frames sent to the neighbor, not counting retransmissions.
+     */
+    uint32_t tx_frames;
+
+    /**
+     * Number of bytes sent to the neighbor, not counting retransmissions.
+     */
+    uint32_t tx_bytes;
+
+    /**
+     * Number of bytes sent to the neighbor during the last second.
+     */
+    uint32_t tx_bytes_per_second;
+
+    /**
+     * Number of frames currently queued for the neighbor.
+     */
+    uint32_t queue_depth;
+
+    /**
+     * Number of retransmissions after the neighbor did not acknowledge a frame.
+     */
+    uint32_t tx_retries;
+
+    /**
+     * Number of frames that were not acknowledged after all retransmissions.
+     */
+    uint32_t tx_lost;
+
+    /**
+     * Share of the recent delivery attempts to the neighbor that failed, in permille.
+     */
+    uint32_t tx_loss_permille;
+
+    /**
+     * Number of times frames for the neighbor had to wait because it could not take any more.
+     */
+    uint32_t credit_stalls;
+
+    /**
+     * Total time in milliseconds that frames for the neighbor waited because it could not take any more.
+     */
+    uint32_t credit_stall_ms;
+
+    /**
+     * Smoothed RSSI of the frames received from the neighbor, in dBm. 0 if nothing was received yet.
+     */
+    int32_t rssi;
+
+    /**
+     * Smoothed share of the expected status beacons of the neighbor that were received, in permille.
+     */
+    uint32_t beacon_ratio_permille;
+
+    /**
+     * Expected number of transmissions until a frame gets across the link and is acknowledged, in hundredths.
+     * Combines the delivery ratios in both directions, 100 is a perfect link.
+     */
+    uint32_t etx_x100;
+} meshnow_link_stats_t;
+
 /**
  * Callback for custom data packets.
  *
@@ -357,6 +670,115 @@ esp_err_t meshnow_get_child_children_num(meshnow_addr_t child, size_t* num);
  */
 esp_err_t meshnow_get_child_children(meshnow_addr_t child, meshnow_addr_t* children, size_t* num);
 
+/**
+ * Get the send statistics of this node.
+ *
+ * @param[out] stats send statistics
+ *
+ * @note
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_send_stats(meshnow_send_stats_t* stats);
+
+/**
+ * Get the link statistics towards a neighbor.
+ *
+ * @param[in] neighbor MAC address of the parent or a direct child
+ * @param[out] stats link statistics
+ *
+ * @note
+ * Returns ESP_ERR_INVALID_ARG if the neighbor is neither the parent nor a direct child of this node.
+ * The counters are reset when the neighbor disconnects.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized/started
+ */
+esp_err_t meshnow_get_link_stats(meshnow_addr_t neighbor, meshnow_link_stats_t* stats);
+
+/**
+ * Get the DNS cache statistics of this node.
+ *
+ * @param[out] stats DNS cache statistics
+ *
+ * @note
+ * Only the root serves DNS, the counters of other nodes stay 0.
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_dns_cache_stats(meshnow_dns_cache_stats_t* stats);
+
+/**
+ * Get the TCP proxy statistics of this node.
+ *
+ * @param[out] stats TCP proxy statistics
+ *
+ * @note
+ * Only the root splits TCP connections, the counters of other nodes and without CONFIG_TCP_PROXY stay 0.
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_tcp_proxy_stats(meshnow_tcp_proxy_stats_t* stats);
+
+/**
+ * Get the handover statistics of this node.
+ *
+ * @param[out] stats handover statistics
+ *
+ * @note
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_handover_stats(meshnow_handover_stats_t* stats);
+
+/**
+ * Get the broadcast statistics of this node.
+ *
+ * @param[out] stats broadcast statistics
+ *
+ * @note
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_broadcast_stats(meshnow_broadcast_stats_t* stats);
+
+/**
+ * Get the queue statistics of this node.
+ *
+ * @param[out] stats queue statistics
+ *
+ * @note
+ * The counters are cumulative since MeshNOW was initialized.
+ *
+ * @return
+ * - ESP_OK: Success
+ * - ESP_ERR_INVALID_ARG: Invalid argument
+ * - ESP_ERR_INVALID_STATE: MeshNOW is not initialized
+ */
+esp_err_t meshnow_get_queue_stats(meshnow_queue_stats_t* stats);
+
 #ifdef __cplusplus
 };
 #endif
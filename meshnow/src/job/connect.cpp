@@ -5,6 +5,7 @@
 #include <nvs_flash.h>
 #include <sdkconfig.h>
 
+#include "constants.hpp"
 #include "layout.hpp"
 #include "lock.hpp"
 #include "meshnow.h"
@@ -62,18 +63,12 @@ void ConnectJob::performAction() {
     std::visit([&](auto &phase) { phase.performAction(*this); }, phase_);
 }
 
-void ConnectJob::event_handler(void *event_handler_arg, esp_event_base_t event_base, int32_t event_id,
-                               void *event_data) {
-    assert(event_base == event::MESHNOW_INTERNAL);
-
+void ConnectJob::handleEvent(event::InternalEvent event, void *event_data) {
     // root never performs any connecting process
     if (state::isRoot()) return;
 
-    auto &job = *static_cast<ConnectJob *>(event_handler_arg);
     // forward to current phase
-    Lock lock;
-    std::visit([&](auto &phase) { phase.event_handler(job, static_cast<event::InternalEvent>(event_id), event_data); },
-               job.phase_);
+    std::visit([&](auto &phase) { phase.event_handler(*this, event, event_data); }, phase_);
 }
 
 // SEARCH PHASE //
@@ -231,6 +226,15 @@ void ConnectJob::ConnectPhase::performAction(ConnectJob &job) {
     if (awaiting_connect_response_) {
         ESP_LOGI(TAG, "Connect request timed out");
         awaiting_connect_response_ = false;
+
+        // a v1 parent cannot read a request carrying the frame size, so ask once more in the v1 form
+        if (!asked_v1_) {
+            asked_v1_ = true;
+            awaiting_connect_response_ = true;
+            last_connect_request_time_ = xTaskGetTickCount();
+            sendConnectRequest(current_parent_mac_, std::nullopt);
+            return;
+        }
     }
 
     // send a connect request to the best potential parent
@@ -248,8 +252,9 @@ void ConnectJob::ConnectPhase::performAction(ConnectJob &job) {
     job.parent_infos_.erase(it);
 
     awaiting_connect_response_ = true;
+    asked_v1_ = false;
     last_connect_request_time_ = xTaskGetTickCount();
-    sendConnectRequest(current_parent_mac_);
+    sendConnectRequest(current_parent_mac_, MAX_FRAME_SIZE);
 }
 
 void ConnectJob::ConnectPhase::event_handler(ConnectJob &job, event::InternalEvent event, void *event_data) {
@@ -269,6 +274,8 @@ void ConnectJob::ConnectPhase::event_handler(ConnectJob &job, event::InternalEve
     // set parent info
     auto &layout = layout::Layout::get();
     layout.setParent(parent_mac);
+    layout.getParent().max_frame_size = response_data.max_frame_size.value_or(ESP_NOW_MAX_DATA_LEN);
+    layout.getParent().v1_node = !response_data.max_frame_size;
 
     // set root mac
     state::setRootMac(response_data.root);
@@ -289,9 +296,10 @@ void ConnectJob::ConnectPhase::event_handler(ConnectJob &job, event::InternalEve
     job.phase_ = DonePhase{};
 }
 
-void ConnectJob::ConnectPhase::sendConnectRequest(const util::MacAddr &to_mac) {
+void ConnectJob::ConnectPhase::sendConnectRequest(const util::MacAddr &to_mac,
+                                                  std::optional<uint16_t> max_frame_size) {
     ESP_LOGI(TAG, "Sending connect request to " MACSTR, MAC2STR(to_mac));
-    send::enqueuePayload(packets::ConnectRequest{}, send::DirectOnce(to_mac));
+    send::enqueuePayload(packets::ConnectRequest{max_frame_size}, send::DirectOnce(to_mac));
 }
 
 // DonePhase //
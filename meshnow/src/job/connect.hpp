@@ -1,6 +1,5 @@
 #pragma once
 
-#include <esp_event.h>
 #include <esp_random.h>
 
 #include <optional>
@@ -9,7 +8,6 @@
 
 #include "event.hpp"
 #include "job.hpp"
-#include "util/event.hpp"
 #include "util/mac.hpp"
 
 namespace meshnow::job {
@@ -22,6 +20,8 @@ class ConnectJob : public Job {
 
     void performAction() override;
 
+    void handleEvent(event::InternalEvent event, void* event_data) override;
+
    private:
     struct ChannelConfig {
         uint8_t min_channel;
@@ -96,8 +96,9 @@ class ConnectJob : public Job {
         /**
          * Sends a connect request to a potential parent.
          * @param to_mac MAC address of the parent
+         * @param max_frame_size largest frame this node can receive, as advertised to the parent, unset for the v1 form
          */
-        static void sendConnectRequest(const util::MacAddr& to_mac);
+        static void sendConnectRequest(const util::MacAddr& to_mac, std::optional<uint16_t> max_frame_size);
 
         /**
          * If this phase just been started.
@@ -118,6 +119,11 @@ class ConnectJob : public Job {
          * The MAC address of the parent we are currently trying to connect to.
          */
         util::MacAddr current_parent_mac_;
+
+        /**
+         * If the current parent was already asked in the v1 form, which v1 nodes can read.
+         */
+        bool asked_v1_{false};
     };
 
     /**
@@ -139,11 +145,6 @@ class ConnectJob : public Job {
 
     using Phase = std::variant<SearchPhase, ConnectPhase, DonePhase>;
 
-    static void event_handler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
-
-    util::EventHandlerInstance event_handler_instance_{event::Internal::handle, event::MESHNOW_INTERNAL,
-                                                       ESP_EVENT_ANY_ID, &ConnectJob::event_handler, this};
-
     const ChannelConfig channel_config_;
     std::vector<ParentInfo> parent_infos_;
     // starts per default with SearchPhase
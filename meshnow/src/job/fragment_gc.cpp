@@ -4,6 +4,8 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+#include <algorithm>
+
 #include "fragments.hpp"
 #include "util/util.hpp"
 
@@ -21,12 +23,16 @@ TickType_t FragmentGCJob::nextActionAt() const noexcept {
         // no fragments, don't need to do anything
         return portMAX_DELAY;
     } else {
-        return youngestFragmentTime + FRAGMENT_TIMEOUT;
+        return std::min(youngestFragmentTime + FRAGMENT_TIMEOUT, fragments::nextNackTime());
     }
 }
 
 void FragmentGCJob::performAction() {
     auto now = xTaskGetTickCount();
+
+    // ask for missing fragments before giving up on them
+    fragments::requestMissing(now);
+
     if (now < FRAGMENT_TIMEOUT) return;  // don't do anything if we haven't been running for long enough
 
     // remove all entries that have timed out
@@ -5,7 +5,7 @@
 namespace meshnow::job {
 
 /**
- * Removes old incomplete fragment reassemblies.
+ * Requests missing fragments of incomplete reassemblies and removes old ones.
  */
 class FragmentGCJob : public Job {
    public:
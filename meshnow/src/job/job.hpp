@@ -2,6 +2,8 @@
 
 #include <freertos/portmacro.h>
 
+#include "event.hpp"
+
 namespace meshnow::job {
 
 class Job {
@@ -17,6 +19,13 @@ class Job {
      * Perform the next action.
      */
     virtual void performAction() = 0;
+
+    /**
+     * Handle an internal event. Always called from the job runner task.
+     * @param event the event that was fired
+     * @param event_data the data attached to the event
+     */
+    virtual void handleEvent(event::InternalEvent event, void* event_data) {}
 };
 
-}  // namespace meshnow::job
\ No newline at end of file
+}  // namespace meshnow::job
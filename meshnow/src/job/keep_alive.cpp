@@ -2,9 +2,12 @@
 
 #include <esp_log.h>
 
+#include "arp_proxy.hpp"
+#include "data/queue.hpp"
 #include "layout.hpp"
 #include "meshnow.h"
 #include "send/queue.hpp"
+#include "short_id.hpp"
 #include "state.hpp"
 #include "util/util.hpp"
 
@@ -38,6 +41,7 @@ void StatusSendJob::performAction() {
     if (layout::Layout::get().isEmpty()) return;
 
     sendStatus();
+    resendShortIds();
 
     last_status_sent_ = now;
 }
@@ -49,11 +53,29 @@ void StatusSendJob::sendStatus() {
     packets::Status payload{
         .state = state,
         .root = state == state::State::REACHES_ROOT ? std::make_optional(state::getRootMac()) : std::nullopt,
+        .credits = data::advertiseCredits(),
     };
 
     send::enqueuePayload(payload, send::NeighborsOnce{});
 }
 
+void StatusSendJob::resendShortIds() {
+    // an assignment or its confirmation may have been lost, so it is sent again until the child confirms it
+    auto resend = [](const layout::Child& child, const layout::Node& node) {
+        if (node.short_id_confirmed) return;
+        if (auto id = short_id::lookup(node.mac)) {
+            send::enqueuePayload(packets::ShortIdAssign{node.mac, *id}, send::DirectOnce(child.mac));
+        }
+    };
+
+    for (const auto& child : layout::Layout::get().getChildren()) {
+        resend(child, child);
+        for (const auto& node : child.routing_table) {
+            resend(child, node);
+        }
+    }
+}
+
 // UnreachableTimeoutJob //
 
 TickType_t UnreachableTimeoutJob::nextActionAt() const noexcept {
@@ -88,28 +110,26 @@ void UnreachableTimeoutJob::performAction() {
     }
 }
 
-void UnreachableTimeoutJob::event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
-    assert(event_base == event::MESHNOW_INTERNAL);
-    assert(event_id == static_cast<int32_t>(event::InternalEvent::STATE_CHANGED));
+void UnreachableTimeoutJob::handleEvent(event::InternalEvent event, void* event_data) {
+    if (event != event::InternalEvent::STATE_CHANGED) return;
 
-    auto& job = *static_cast<UnreachableTimeoutJob*>(arg);
     auto data = *static_cast<event::StateChangedEvent*>(event_data);
     auto new_state = data.new_state;
     auto old_state = data.old_state;
 
-    if (job.awaiting_reachable) {
+    if (awaiting_reachable) {
         if (old_state == state::State::CONNECTED_TO_PARENT && new_state == state::State::REACHES_ROOT) {
             // root is reachable again
             ESP_LOGI(TAG, "Root is reachable again");
         }
-        job.awaiting_reachable = false;
-        job.mesh_unreachable_since_ = 0;
+        awaiting_reachable = false;
+        mesh_unreachable_since_ = 0;
     } else {
         if (old_state == state::State::REACHES_ROOT && new_state == state::State::CONNECTED_TO_PARENT) {
             // root became unreachable
             ESP_LOGI(TAG, "Root became unreachable");
-            job.awaiting_reachable = true;
-            job.mesh_unreachable_since_ = xTaskGetTickCount();
+            awaiting_reachable = true;
+            mesh_unreachable_since_ = xTaskGetTickCount();
         }
     }
 }
@@ -148,10 +168,12 @@ void NeighborCheckJob::performAction() {
     for (auto it = layout.getChildren().begin(); it != layout.getChildren().end();) {
         if (now - it->last_seen > KEEP_ALIVE_TIMEOUT) {
             auto mac = it->mac;
+            // the nodes below the child are gone with it
+            auto subtree = std::move(it->routing_table);
             ESP_LOGW(TAG, "Direct child " MACSTR " timed out", MAC2STR(mac));
             layout.removeChild(it->mac);
             // send event upstream
-            sendChildDisconnected(mac);
+            sendChildDisconnected(mac, subtree);
         } else {
             ++it;
         }
@@ -178,15 +200,25 @@ void NeighborCheckJob::performAction() {
     }
 }
 
-void NeighborCheckJob::sendChildDisconnected(const util::MacAddr& mac) {
+void NeighborCheckJob::sendChildDisconnected(const util::MacAddr& mac, const std::vector<layout::Node>& subtree) {
+    // same as for a removal coming from below
+    short_id::forget(mac);
+    arp_proxy::forget(mac);
+    for (const auto& node : subtree) {
+        short_id::forget(node.mac);
+        arp_proxy::forget(node.mac);
+    }
+
     if (state::isRoot()) return;
     if (!layout::Layout::get().hasParent()) return;
 
     ESP_LOGI(TAG, "Sending child disconnected event upstream");
 
-    // send to parent
-    auto payload = packets::RoutingTableRemove{mac};
-    send::enqueuePayload(payload, send::UpstreamRetry{});
+    // send to parent, every node upstream has the whole subtree in its routing table
+    send::enqueuePayload(packets::RoutingTableRemove{mac}, send::UpstreamRetry{});
+    for (const auto& node : subtree) {
+        send::enqueuePayload(packets::RoutingTableRemove{node.mac}, send::UpstreamRetry{});
+    }
 }
 
 }  // namespace meshnow::job
\ No newline at end of file
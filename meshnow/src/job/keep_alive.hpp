@@ -1,15 +1,14 @@
 #pragma once
 
-#include <esp_event.h>
 #include <freertos/portmacro.h>
 
 #include <memory>
+#include <vector>
 
 #include "event.hpp"
 #include "job.hpp"
 #include "layout.hpp"
 #include "send/worker.hpp"
-#include "util/event.hpp"
 
 namespace meshnow::job {
 
@@ -18,26 +17,27 @@ class StatusSendJob : public Job {
     TickType_t nextActionAt() const noexcept override;
     void performAction() override;
 
-   private:
     /**
-     * Sends status beacons to all neighborsSingleTry.
+     * Sends status beacons to all neighborsSingleTry. Must be called with the lock held.
      */
     static void sendStatus();
 
+   private:
+    /**
+     * Sends the short IDs the children have not confirmed yet to them again.
+     */
+    static void resendShortIds();
+
     TickType_t last_status_sent_{0};
 };
 
 class UnreachableTimeoutJob : public Job {
    public:
-    static void event_handler(void* event_handler_arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
-
     TickType_t nextActionAt() const noexcept override;
     void performAction() override;
+    void handleEvent(event::InternalEvent event, void* event_data) override;
 
    private:
-    util::EventHandlerInstance event_handler_instance_{event::Internal::handle, event::MESHNOW_INTERNAL,
-                                                       static_cast<int32_t>(event::InternalEvent::STATE_CHANGED),
-                                                       &UnreachableTimeoutJob::event_handler, this};
     TickType_t mesh_unreachable_since_{0};
     bool awaiting_reachable{false};
 };
@@ -49,9 +49,10 @@ class NeighborCheckJob : public Job {
 
    private:
     /**
-     * Sends a child disconnected message upstream if possible.
-     * @param mac_addr the MAC address of the child that disconnected
+     * Sends a child disconnected message upstream for the child and every node below it, if possible.
+     * @param mac the MAC address of the child that disconnected
+     * @param subtree the routing table of the child
      */
-    static void sendChildDisconnected(const util::MacAddr& mac);
+    static void sendChildDisconnected(const util::MacAddr& mac, const std::vector<layout::Node>& subtree);
 };
 }  // namespace meshnow::job
\ No newline at end of file
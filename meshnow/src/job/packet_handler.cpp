@@ -2,13 +2,21 @@
 
 #include <esp_log.h>
 
+#include <algorithm>
 #include <lock.hpp>
 
+#include "arp_proxy.hpp"
+#include "constants.hpp"
 #include "custom.hpp"
 #include "event.hpp"
 #include "fragments.hpp"
+#include "header_compression.hpp"
 #include "layout.hpp"
+#include "link_quality.hpp"
+#include "send/parking.hpp"
 #include "send/queue.hpp"
+#include "send/retransmit.hpp"
+#include "short_id.hpp"
 #include "state.hpp"
 #include "util/util.hpp"
 
@@ -16,13 +24,6 @@ namespace meshnow::job {
 
 static constexpr auto TAG = CREATE_TAG("PacketHandler");
 
-static bool isForMe(const packets::Packet& packet) {
-    if (packet.to == state::getThisMac()) return true;
-    if (packet.to == util::MacAddr::broadcast()) return true;
-    if (packet.to == util::MacAddr::root() && state::isRoot()) return true;
-    return false;
-}
-
 void PacketHandler::handlePacket(const util::MacAddr& from, int rssi, const packets::Packet& packet) {
     // TODO handle duplicate packets
     // TODO update routing table
@@ -30,16 +31,7 @@ void PacketHandler::handlePacket(const util::MacAddr& from, int rssi, const pack
 
     auto& payload = packet.payload;
 
-    // forward if not designated to this node
-    if (!isForMe(packet)) {
-        send::enqueuePayload(packet.payload, send::FullyResolve(packet.from, packet.to, from), packet.id);
-        return;
-    }
-
-    // if broadcast, send to every node
-    if (packet.to == util::MacAddr::broadcast()) {
-        send::enqueuePayload(packet.payload, send::FullyResolve(packet.from, packet.to, from), packet.id);
-    }
+    if (forward(from, packet)) return;
 
     MetaData meta{
         .last_hop = from,
@@ -49,9 +41,41 @@ void PacketHandler::handlePacket(const util::MacAddr& from, int rssi, const pack
 
     // simply visit the corresponding overload
     Lock lock;
+
+    auto& layout = layout::Layout::get();
+    if (layout.hasNeighbor(from)) {
+        link_quality::onReceive(layout.getNeighbor(from).link_stats, rssi);
+    }
+
     std::visit([&](const auto& p) { handle(meta, p); }, payload);
 }
 
+void PacketHandler::handleDataPacket(const util::MacAddr& from, bool is_neighbor, const packets::Packet& packet) {
+    if (forward(from, packet)) return;
+
+    // reassembly state belongs to the data worker alone, so fragments for this node need no lock
+    auto p = std::get_if<packets::DataFragment>(&packet.payload);
+    if (!p || !is_neighbor) return;
+
+    fragments::addFragment(packet.from, p->frag_id, p->options.unpacked.frag_num, p->options.unpacked.total_size,
+                           p->options.unpacked.large, p->options.unpacked.compressed, p->data);
+}
+
+bool PacketHandler::forward(const util::MacAddr& from, const packets::Packet& packet) {
+    // forward if not designated to this node
+    if (!state::isForMe(packet.to)) {
+        send::enqueuePayload(packet.payload, send::FullyResolve(packet.from, packet.to, from), packet.id);
+        return true;
+    }
+
+    // if broadcast, send to every node
+    if (packet.to == util::MacAddr::broadcast()) {
+        send::enqueuePayload(packet.payload, send::FullyResolve(packet.from, packet.to, from), packet.id);
+    }
+
+    return false;
+}
+
 /**
  * Helper functions
  */
@@ -90,6 +114,40 @@ inline bool isNeighbor(const util::MacAddr& mac) { return isParent(mac) || isChi
 
 inline bool canAcceptNewChild() { return layout().getChildren().size() < layout::MAX_CHILDREN; }
 
+/**
+ * Returns the direct child that either is the given node or has it in its routing table.
+ */
+inline layout::Child* childTowards(const util::MacAddr& mac) {
+    for (auto& child : layout().getChildren()) {
+        if (child.mac == mac) return &child;
+        if (std::any_of(child.routing_table.begin(), child.routing_table.end(),
+                        [&](const layout::Node& node) { return node.mac == mac; })) {
+            return &child;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Announces a node that joined below this node: the root assigns it a short ID, everyone else tells their parent.
+ */
+inline void announceNode(const util::MacAddr& mac) {
+    if (!state::isRoot()) {
+        send::enqueuePayload(packets::RoutingTableAdd{mac}, send::UpstreamRetry{});
+        return;
+    }
+
+    auto short_id = short_id::assign(mac);
+    auto* child = childTowards(mac);
+    if (!child) return;
+
+    ESP_LOGD(TAG, "Assigning short ID %u to " MACSTR, short_id, MAC2STR(mac));
+    send::enqueuePayload(packets::ShortIdAssign{mac, short_id}, send::DirectOnce(child->mac));
+
+    // the node may have just changed its parent, so deliver what arrived for it in the meantime
+    send::unparkFrames(mac);
+}
+
 inline bool disconnected() {
     if (state::getState() == state::State::DISCONNECTED_FROM_PARENT) {
         assert(!state::isRoot() && "Cannot be disconnected and root at the same time");
@@ -109,6 +167,12 @@ void PacketHandler::handle(const MetaData& meta, const packets::Status& p) {
 
     auto& layout = layout::Layout::get();
 
+    if (layout.hasNeighbor(meta.from)) {
+        auto& neighbor = layout.getNeighbor(meta.from);
+        neighbor.credits = p.credits;
+        link_quality::onBeacon(neighbor.link_stats, xTaskGetTickCount());
+    }
+
     // is child?
     if (layout.hasChild(meta.from)) {
         auto& child = layout.getChild(meta.from);
@@ -174,15 +238,29 @@ void PacketHandler::handle(const MetaData& meta, const packets::ConnectRequest&
 
     // add to layout
     layout().addChild(meta.from);
+    if (layout().hasChild(meta.from)) {
+        auto& child = layout().getChild(meta.from);
+        child.max_frame_size = p.max_frame_size.value_or(ESP_NOW_MAX_DATA_LEN);
+        child.v1_node = !p.max_frame_size;
+    }
 
     ESP_LOGI(TAG, "Child " MACSTR " connected", MAC2STR(meta.from));
 
+    // let the job runner know that there is a new neighbor to keep alive
+    event::ChildConnectedData data{
+        .child = meta.from,
+    };
+    event::Internal::fire(event::InternalEvent::CHILD_CONNECTED, &data, sizeof(data));
+
     // send reply
     ESP_LOGV(TAG, "Sending Connect Response");
-    send::enqueuePayload(packets::ConnectOk{state::getRootMac()}, send::DirectOnce(meta.from));
+    // a child that asked in the v1 form can only read the v1 form of the reply
+    std::optional<uint16_t> max_frame_size;
+    if (p.max_frame_size) max_frame_size = std::min(MAX_FRAME_SIZE, *p.max_frame_size);
+    send::enqueuePayload(packets::ConnectOk{state::getRootMac(), max_frame_size}, send::DirectOnce(meta.from));
 
-    // send routing table add packet upstream
-    send::enqueuePayload(packets::RoutingTableAdd{meta.from}, send::UpstreamRetry{});
+    // let the nodes upstream know
+    announceNode(meta.from);
 }
 
 void PacketHandler::handle(const MetaData& meta, const packets::ConnectOk& p) {
@@ -194,6 +272,7 @@ void PacketHandler::handle(const MetaData& meta, const packets::ConnectOk& p) {
     event::GotConnectResponseData data{
         .parent = meta.from,
         .root = p.root,
+        .max_frame_size = p.max_frame_size,
     };
     event::Internal::fire(event::InternalEvent::GOT_CONNECT_RESPONSE, &data, sizeof(data));
 }
@@ -204,7 +283,25 @@ void PacketHandler::handle(const MetaData& meta, const packets::RoutingTableAdd&
 
     // get child matching last hop
     auto& child = layout().getChild(meta.last_hop);
+
+    // the node moved here from below another child, whose entry is stale until its removal arrives
+    for (auto& other : layout().getChildren()) {
+        if (other.mac == child.mac) continue;
+        std::erase_if(other.routing_table, [&](const layout::Node& node) { return node.mac == p.entry; });
+    }
+
+    // the node is already known, a repeated add must not announce it again
+    if (std::any_of(child.routing_table.begin(), child.routing_table.end(),
+                    [&](const layout::Node& node) { return node.mac == p.entry; })) {
+        // but it may have moved further down, so deliver what the root held back for it
+        if (state::isRoot()) send::unparkFrames(p.entry);
+        return;
+    }
+
     child.routing_table.emplace_back(p.entry);
+
+    // propagate further so that every node up to the root knows how to reach the entry
+    announceNode(p.entry);
 }
 
 void PacketHandler::handle(const MetaData& meta, const packets::RoutingTableRemove& p) {
@@ -213,8 +310,17 @@ void PacketHandler::handle(const MetaData& meta, const packets::RoutingTableRemo
 
     // this removes the entry from the routing table of the node the packet directly came from
     auto& child = layout().getChild(meta.last_hop);
-    std::remove_if(child.routing_table.begin(), child.routing_table.end(),
-                   [&](const auto& item) { return item.mac == p.entry; });
+    // the node may have already moved below another child, then the removal is stale and ends here
+    if (std::erase_if(child.routing_table, [&](const auto& item) { return item.mac == p.entry; }) == 0) return;
+    if (childTowards(p.entry)) return;
+
+    short_id::forget(p.entry);
+    arp_proxy::forget(p.entry);
+
+    // propagate further up to the root
+    if (!state::isRoot()) {
+        send::enqueuePayload(packets::RoutingTableRemove{p.entry}, send::UpstreamRetry{});
+    }
 }
 
 void PacketHandler::handle(const MetaData& meta, const packets::RootUnreachable& p) {
@@ -238,14 +344,15 @@ void PacketHandler::handle(const MetaData& meta, const packets::RootReachable& p
     state::setState(state::State::REACHES_ROOT);
 
     // forward to all children
-    send::enqueuePayload(packets::RootUnreachable{}, send::DownstreamRetry{});
+    send::enqueuePayload(packets::RootReachable{p.root}, send::DownstreamRetry{});
 }
 
 void PacketHandler::handle(const MetaData& meta, const packets::DataFragment& p) {
     if (!isNeighbor(meta.last_hop)) return;
 
     // add to fragment reassembly
-    fragments::addFragment(meta.from, p.frag_id, p.options.unpacked.frag_num, p.options.unpacked.total_size, p.data);
+    fragments::addFragment(meta.from, p.frag_id, p.options.unpacked.frag_num, p.options.unpacked.total_size,
+                           p.options.unpacked.large, p.options.unpacked.compressed, p.data);
 }
 
 void PacketHandler::handle(const MetaData& meta, const packets::CustomData& p) {
@@ -261,4 +368,54 @@ void PacketHandler::handle(const MetaData& meta, const packets::CustomData& p) {
     }
 }
 
-}  // namespace meshnow::job
\ No newline at end of file
+void PacketHandler::handle(const MetaData&, const packets::Aggregate&) {
+    // already split up by the receiver
+}
+
+void PacketHandler::handle(const MetaData& meta, const packets::CompressionNack& p) {
+    header_compression::resync(meta.from, p.flow_id);
+}
+
+void PacketHandler::handle(const MetaData& meta, const packets::FragmentNack& p) {
+    if (!send::resendFragments(p.frag_id, p.missing)) {
+        ESP_LOGD(TAG, "Frame %lu of NACK from " MACSTR " is not kept anymore", p.frag_id, MAC2STR(meta.from));
+    }
+}
+
+void PacketHandler::handle(const MetaData& meta, const packets::ShortIdAssign& p) {
+    if (!isParent(meta.last_hop)) return;
+
+    // every node on the path learns the ID, so that it can resolve compact headers from and to the node
+    short_id::learn(p.node, p.short_id);
+
+    // only now the parent may use the ID towards this node
+    send::enqueuePayload(packets::ShortIdConfirm{p.node, p.short_id}, send::DirectOnce(meta.last_hop));
+
+    if (p.node == state::getThisMac()) {
+        ESP_LOGI(TAG, "Got short ID %u", p.short_id);
+        return;
+    }
+
+    // pass it on towards the node
+    auto* child = childTowards(p.node);
+    if (!child) return;
+    send::enqueuePayload(p, send::DirectOnce(child->mac));
+}
+
+void PacketHandler::handle(const MetaData& meta, const packets::ShortIdConfirm& p) {
+    if (!layout().hasChild(meta.last_hop)) return;
+
+    // a confirmation of an ID that has changed in the meantime is of no use
+    if (short_id::lookup(p.node) != p.short_id) return;
+
+    auto& child = layout().getChild(meta.last_hop);
+    if (child.mac == p.node) {
+        child.short_id_confirmed = true;
+        return;
+    }
+    for (auto& node : child.routing_table) {
+        if (node.mac == p.node) node.short_id_confirmed = true;
+    }
+}
+
+}  // namespace meshnow::job
@@ -22,7 +22,21 @@ class PacketHandler {
      */
     static void handlePacket(const util::MacAddr& from, int rssi, const packets::Packet& packet);
 
+    /**
+     * Handle a packet of the data plane, i.e. one to forward or a data fragment, without taking the lock.
+     * @param from the mac address of the sender
+     * @param is_neighbor whether the sender is the parent or a child, which the caller knows from a snapshot of the layout
+     * @param packet the packet to handle
+     */
+    static void handleDataPacket(const util::MacAddr& from, bool is_neighbor, const packets::Packet& packet);
+
    private:
+    /**
+     * Forwards the packet if it is not only designated to this node.
+     * @return true iff the packet is not designated to this node at all
+     */
+    static bool forward(const util::MacAddr& from, const packets::Packet& packet);
+
     // HANDLERS for each payload type //
 
     static void handle(const MetaData& meta, const packets::Status& p);
@@ -36,6 +50,15 @@ class PacketHandler {
     static void handle(const MetaData& meta, const packets::RootReachable& p);
     static void handle(const MetaData& meta, const packets::DataFragment& p);
     static void handle(const MetaData& meta, const packets::CustomData& p);
+    static void handle(const MetaData& meta, const packets::Aggregate& p);
+
+    static void handle(const MetaData& meta, const packets::ShortIdAssign& p);
+
+    static void handle(const MetaData& meta, const packets::CompressionNack& p);
+
+    static void handle(const MetaData& meta, const packets::FragmentNack& p);
+
+    static void handle(const MetaData& meta, const packets::ShortIdConfirm& p);
 };
 
 }  // namespace meshnow::job
\ No newline at end of file
@@ -0,0 +1,90 @@
+#include "scheduler.hpp"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <algorithm>
+
+#include "lock.hpp"
+
+namespace meshnow::job {
+
+Scheduler::Scheduler(std::initializer_list<std::reference_wrapper<Job>> jobs)
+    : jobs_(jobs), generations_(jobs.size(), 0) {
+    heap_.reserve(jobs_.size());
+    due_.reserve(jobs_.size());
+}
+
+void Scheduler::arm(size_t job) {
+    // invalidate all previous entries of this job
+    generations_[job]++;
+
+    TickType_t deadline;
+    {
+        Lock lock;
+        deadline = jobs_[job].get().nextActionAt();
+    }
+
+    // jobs that never want to run are not put into the heap at all
+    if (deadline == portMAX_DELAY) return;
+
+    heap_.push_back(Entry{deadline, job, generations_[job]});
+    std::push_heap(heap_.begin(), heap_.end());
+}
+
+void Scheduler::armAll() {
+    // every job gets a fresh entry anyway, so drop the old ones instead of letting stale entries pile up
+    heap_.clear();
+    for (size_t job = 0; job < jobs_.size(); ++job) {
+        arm(job);
+    }
+}
+
+TickType_t Scheduler::timeout(TickType_t max_timeout) const {
+    if (heap_.empty()) return max_timeout;
+
+    auto now = xTaskGetTickCount();
+    auto deadline = heap_.front().deadline;
+    if (deadline <= now) return 0;
+    return std::min(deadline - now, max_timeout);
+}
+
+void Scheduler::runDue() {
+    auto now = xTaskGetTickCount();
+
+    // collect all due jobs first, so that a job that is immediately due again only runs once per call
+    due_.clear();
+    while (!heap_.empty() && heap_.front().deadline <= now) {
+        std::pop_heap(heap_.begin(), heap_.end());
+        auto entry = heap_.back();
+        heap_.pop_back();
+
+        if (isStale(entry)) continue;
+        due_.push_back(entry.job);
+    }
+
+    for (auto job : due_) {
+        {
+            Lock lock;
+            // the deadline might have moved into the future in the meantime
+            if (jobs_[job].get().nextActionAt() <= now) {
+                jobs_[job].get().performAction();
+            }
+        }
+        arm(job);
+    }
+}
+
+void Scheduler::dispatch(event::InternalEvent event, void* event_data) {
+    {
+        Lock lock;
+        for (auto job : jobs_) {
+            job.get().handleEvent(event, event_data);
+        }
+    }
+
+    // events may change the deadline of any job
+    armAll();
+}
+
+}  // namespace meshnow::job
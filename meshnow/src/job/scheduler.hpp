@@ -0,0 +1,73 @@
+#pragma once
+
+#include <freertos/portmacro.h>
+
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+#include "job.hpp"
+
+namespace meshnow::job {
+
+/**
+ * Keeps the deadlines of all jobs in a min-heap so that the runner only has to look at the job that is due next.
+ *
+ * Deadlines moving into the future are handled lazily: when an entry becomes due, the job is asked again and
+ * re-armed if it is not actually due yet. Deadlines moving closer (e.g. after an event) require an explicit re-arm.
+ */
+class Scheduler {
+   public:
+    Scheduler(std::initializer_list<std::reference_wrapper<Job>> jobs);
+
+    /**
+     * Re-reads the deadlines of all jobs.
+     */
+    void armAll();
+
+    /**
+     * @param max_timeout the maximum timeout to return
+     * @return ticks until the earliest deadline
+     */
+    TickType_t timeout(TickType_t max_timeout) const;
+
+    /**
+     * Performs the action of every job that is due and re-arms these jobs afterwards.
+     */
+    void runDue();
+
+    /**
+     * Forwards an internal event to every job.
+     */
+    void dispatch(event::InternalEvent event, void* event_data);
+
+   private:
+    struct Entry {
+        TickType_t deadline;
+        size_t job;
+        uint32_t generation;
+
+        // inverted to turn the max-heap of the standard library into a min-heap
+        bool operator<(const Entry& other) const { return deadline > other.deadline; }
+    };
+
+    /**
+     * Re-reads the deadline of a single job. Previous heap entries of the job are invalidated.
+     */
+    void arm(size_t job);
+
+    bool isStale(const Entry& entry) const { return entry.generation != generations_[entry.job]; }
+
+    std::vector<std::reference_wrapper<Job>> jobs_;
+
+    // current generation of each job, heap entries of older generations are skipped
+    std::vector<uint32_t> generations_;
+
+    std::vector<Entry> heap_;
+
+    // scratch space for runDue() to avoid allocating each time
+    std::vector<size_t> due_;
+};
+
+}  // namespace meshnow::job
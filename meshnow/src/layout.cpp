@@ -72,6 +72,13 @@ Child& Layout::getChild(const util::MacAddr& mac) {
     assert(false);
 }
 
+bool Layout::hasNeighbor(const util::MacAddr& mac) const { return (parent_ && parent_->mac == mac) || hasChild(mac); }
+
+Neighbor& Layout::getNeighbor(const util::MacAddr& mac) {
+    if (parent_ && parent_->mac == mac) return *parent_;
+    return getChild(mac);
+}
+
 std::span<Child> Layout::getChildren() { return {children_.data(), children_.size()}; }
 
 }  // namespace meshnow::layout
\ No newline at end of file
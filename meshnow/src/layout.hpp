@@ -1,6 +1,7 @@
 #pragma once
 
 #include <freertos/FreeRTOS.h>
+#include <esp_now.h>
 #include <freertos/semphr.h>
 #include <sdkconfig.h>
 
@@ -21,11 +22,50 @@ struct Node {
     explicit Node(const util::MacAddr& mac) : mac{mac} {}
     util::MacAddr mac;
     uint32_t seq{0};
+    // the next hop towards this node confirmed that it knows the short ID of this node
+    bool short_id_confirmed{false};
+};
+
+/**
+ * Link-level counters and quality estimates towards a neighbor.
+ */
+struct LinkStats {
+    // frames sent to this neighbor for the first time
+    uint32_t tx_frames{0};
+    // bytes sent to this neighbor, not counting retransmissions
+    uint32_t tx_bytes{0};
+    // bytes sent to this neighbor during the last second
+    uint32_t tx_bytes_per_second{0};
+    // frames currently queued for this neighbor
+    uint32_t queue_depth{0};
+    // retransmissions after the driver reported a failed delivery
+    uint32_t tx_retries{0};
+    // frames given up on after all retransmissions failed
+    uint32_t tx_lost{0};
+    // share of recent delivery attempts that failed, in permille
+    uint32_t loss_permille{0};
+    // times frames for this neighbor had to wait because it ran out of credits
+    uint32_t credit_stalls{0};
+    // total time frames for this neighbor waited for credits
+    uint32_t credit_stall_ms{0};
+    // smoothed RSSI of the frames received from this neighbor, in 1/16 dBm, unset until the first frame
+    std::optional<int32_t> rssi_x16;
+    // smoothed share of the expected status beacons of this neighbor that were received, in permille
+    uint32_t beacon_ratio_permille{1000};
+    // when the last status beacon of this neighbor was received
+    std::optional<TickType_t> last_beacon;
 };
 
 struct Neighbor : Node {
     using Node::Node;
     TickType_t last_seen{xTaskGetTickCount()};
+    LinkStats link_stats;
+    // largest frame the neighbor can receive, exchanged when connecting
+    uint16_t max_frame_size{ESP_NOW_MAX_DATA_LEN};
+    // the neighbor connected in the v1 form, so it can only read the v1 form of packets
+    bool v1_node{true};
+    // credits advertised by the neighbor that the send worker has not taken over yet
+    std::optional<uint8_t> credits;
 };
 
 struct Child : Neighbor {
@@ -79,6 +119,16 @@ struct Layout {
 
     void addChild(const util::MacAddr& addr);
 
+    /**
+     * Returns true iff the parent or a direct child has the given mac.
+     */
+    bool hasNeighbor(const util::MacAddr& mac) const;
+
+    /**
+     * Returns the parent or the direct child with the given mac.
+     */
+    Neighbor& getNeighbor(const util::MacAddr& mac);
+
    private:
     Layout() = default;
     ~Layout() = default;
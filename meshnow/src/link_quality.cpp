@@ -0,0 +1,58 @@
+#include "link_quality.hpp"
+
+#include <sdkconfig.h>
+
+#include <algorithm>
+
+namespace meshnow::link_quality {
+
+// neighbors send a status beacon once per interval
+static constexpr auto STATUS_SEND_INTERVAL = pdMS_TO_TICKS(CONFIG_STATUS_SEND_INTERVAL);
+
+// new samples weigh 1/SMOOTHING, so the estimates follow about the last SMOOTHING samples
+static constexpr int32_t SMOOTHING{8};
+
+void onReceive(layout::LinkStats& link_stats, int rssi) {
+    int32_t sample = rssi * 16;
+    if (!link_stats.rssi_x16) {
+        link_stats.rssi_x16 = sample;
+    } else {
+        *link_stats.rssi_x16 += (sample - *link_stats.rssi_x16) / SMOOTHING;
+    }
+}
+
+static void addBeaconSample(layout::LinkStats& link_stats, uint32_t sample) {
+    auto ratio = static_cast<int32_t>(link_stats.beacon_ratio_permille);
+    link_stats.beacon_ratio_permille = ratio + (static_cast<int32_t>(sample) - ratio) / SMOOTHING;
+}
+
+void onBeacon(layout::LinkStats& link_stats, TickType_t now) {
+    if (link_stats.last_beacon) {
+        auto elapsed = now - *link_stats.last_beacon;
+        // beacons sent ahead of time to advertise credits do not stand for an interval of their own
+        if (elapsed < STATUS_SEND_INTERVAL / 2) return;
+
+        // every interval without a beacon counts as a missed one, at most as many as it takes to forget the past
+        uint32_t missed = (elapsed + STATUS_SEND_INTERVAL / 2) / STATUS_SEND_INTERVAL - 1;
+        for (uint32_t i = 0; i < std::min<uint32_t>(missed, 4 * SMOOTHING); ++i) {
+            addBeaconSample(link_stats, 0);
+        }
+    }
+    addBeaconSample(link_stats, 1000);
+    link_stats.last_beacon = now;
+}
+
+int32_t rssi(const layout::LinkStats& link_stats) { return link_stats.rssi_x16.value_or(0) / 16; }
+
+uint32_t etx(const layout::LinkStats& link_stats) {
+    // retries count as failed attempts, so this is the delivery ratio of a single transmission
+    uint32_t forward = 1000 - std::min<uint32_t>(link_stats.loss_permille, 1000);
+    uint32_t reverse = link_stats.beacon_ratio_permille;
+    if (forward == 0 || reverse == 0) return MAX_ETX_X100;
+
+    // 1 / (forward * reverse) with both ratios in permille
+    uint64_t etx = 100'000'000ULL / (static_cast<uint64_t>(forward) * reverse);
+    return std::min<uint64_t>(etx, MAX_ETX_X100);
+}
+
+}  // namespace meshnow::link_quality
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include <cstdint>
+
+#include "layout.hpp"
+
+namespace meshnow::link_quality {
+
+/**
+ * Estimates the quality of the link to every neighbor from what is observed anyway.
+ *
+ * The RSSI of received frames is smoothed, the status beacons of the neighbor give the delivery ratio towards this
+ * node, and the acknowledgements of sent frames the delivery ratio towards the neighbor. Both ratios combine into the
+ * expected transmission count (ETX), which is 1 for a perfect link and grows as either direction loses frames.
+ *
+ * All functions must be called with the lock held.
+ */
+
+// ETX of a link over which nothing gets through, in hundredths
+constexpr uint32_t MAX_ETX_X100{100 * 100};
+
+/**
+ * Folds the RSSI of a frame received from the neighbor into its smoothed RSSI.
+ */
+void onReceive(layout::LinkStats& link_stats, int rssi);
+
+/**
+ * Counts a status beacon received from the neighbor, along with the ones missed since the last one.
+ */
+void onBeacon(layout::LinkStats& link_stats, TickType_t now);
+
+/**
+ * Returns the smoothed RSSI of the neighbor in dBm, or 0 if nothing was received yet.
+ */
+int32_t rssi(const layout::LinkStats& link_stats);
+
+/**
+ * Returns the expected number of transmissions until a frame gets across the link and is acknowledged, in hundredths.
+ */
+uint32_t etx(const layout::LinkStats& link_stats);
+
+}  // namespace meshnow::link_quality
@@ -14,4 +14,6 @@ Lock::Lock() {
 
 Lock::~Lock() { xSemaphoreGive(handle_); }
 
+bool Lock::isHeld() { return handle_ != nullptr && xSemaphoreGetMutexHolder(handle_) == xTaskGetCurrentTaskHandle(); }
+
 }  // namespace meshnow
\ No newline at end of file
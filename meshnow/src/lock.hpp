@@ -18,6 +18,11 @@ class Lock {
 
     Lock& operator=(Lock&& other) = delete;
 
+    /**
+     * Returns true iff the calling task holds the lock.
+     */
+    static bool isHeld();
+
    private:
     static SemaphoreHandle_t handle_;
 };
@@ -5,13 +5,26 @@
 #include <esp_wifi.h>
 #include <nvs_flash.h>
 
+#include <algorithm>
+
 #include "custom.hpp"
+#include "data/queue.hpp"
+#include "dns_cache.hpp"
 #include "event.hpp"
+#include "fragments.hpp"
+#include "header_compression.hpp"
 #include "layout.hpp"
+#include "link_quality.hpp"
 #include "lock.hpp"
+#include "netif.hpp"
 #include "networking.hpp"
+#include "receive/queue.hpp"
+#include "send/parking.hpp"
 #include "send/queue.hpp"
+#include "send/retransmit.hpp"
+#include "send/worker.hpp"
 #include "state.hpp"
+#include "tcp_proxy.hpp"
 #include "util/mac.hpp"
 #include "util/util.hpp"
 #include "wifi.hpp"
@@ -431,4 +444,181 @@ extern "C" esp_err_t meshnow_visible_mesh_size(size_t* size) {
     *size = result;
 
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+extern "C" esp_err_t meshnow_get_send_stats(meshnow_send_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto send_stats = meshnow::send::getStats();
+    stats->frames_sent = send_stats.frames_sent;
+    stats->frames_dropped = send_stats.frames_dropped;
+    stats->frames_failed = send_stats.frames_failed;
+    stats->completions_lost = send_stats.completions_lost;
+    stats->frames_per_second = send_stats.frames_per_second;
+    stats->aggregate_frames = send_stats.aggregate_frames;
+    stats->aggregated_packets = send_stats.aggregated_packets;
+    stats->aggregation_delay_ms = send_stats.aggregate_frames == 0
+                                      ? 0
+                                      : pdTICKS_TO_MS(send_stats.aggregation_delay_ticks) / send_stats.aggregate_frames;
+    stats->compact_frames = send_stats.compact_frames;
+    stats->acks_superseded = send_stats.acks_superseded;
+    stats->parity_fragments = send_stats.parity_fragments;
+    stats->frames_evicted = send_stats.frames_evicted;
+    stats->frames_delay_dropped = send_stats.frames_delay_dropped;
+    stats->frames_expired = send_stats.frames_expired;
+    stats->frames_neighbor_gone = send_stats.frames_neighbor_gone;
+    stats->control_coalesced = send_stats.control_coalesced;
+    stats->items_dropped = meshnow::send::droppedItems();
+    static_assert(MESHNOW_PRIORITY_MAX == meshnow::packets::NUM_PRIORITIES);
+    std::copy(send_stats.queue_delay_p50_ms.begin(), send_stats.queue_delay_p50_ms.end(), stats->queue_delay_p50_ms);
+    std::copy(send_stats.queue_delay_p99_ms.begin(), send_stats.queue_delay_p99_ms.end(), stats->queue_delay_p99_ms);
+    stats->fragments_recovered = meshnow::fragments::recoveredFragments();
+    stats->fragment_nacks = meshnow::fragments::nacksSent();
+    stats->fragment_resends = meshnow::send::resentFrames();
+
+    auto compression_stats = meshnow::header_compression::getStats();
+    stats->compressed_ip_frames = compression_stats.compressed_frames;
+    stats->compression_bytes_saved = compression_stats.bytes_saved;
+    stats->compression_resyncs = compression_stats.resyncs;
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_link_stats(meshnow_addr_t neighbor, meshnow_link_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!started) {
+        ESP_LOGE(TAG, "MeshNOW is not started!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (neighbor == nullptr || stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    meshnow::Lock lock;
+
+    auto& layout = meshnow::layout::Layout::get();
+
+    if (!layout.hasNeighbor(meshnow::util::MacAddr{neighbor})) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto& link_stats = layout.getNeighbor(meshnow::util::MacAddr{neighbor}).link_stats;
+    stats->tx_frames = link_stats.tx_frames;
+    stats->tx_bytes = link_stats.tx_bytes;
+    stats->tx_bytes_per_second = link_stats.tx_bytes_per_second;
+    stats->queue_depth = link_stats.queue_depth;
+    stats->tx_retries = link_stats.tx_retries;
+    stats->tx_lost = link_stats.tx_lost;
+    stats->tx_loss_permille = link_stats.loss_permille;
+    stats->credit_stalls = link_stats.credit_stalls;
+    stats->credit_stall_ms = link_stats.credit_stall_ms;
+    stats->rssi = meshnow::link_quality::rssi(link_stats);
+    stats->beacon_ratio_permille = link_stats.beacon_ratio_permille;
+    stats->etx_x100 = meshnow::link_quality::etx(link_stats);
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_dns_cache_stats(meshnow_dns_cache_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto dns_stats = meshnow::dns_cache::getStats();
+    stats->queries = dns_stats.queries;
+    stats->cache_hits = dns_stats.hits;
+    stats->upstream_queries = dns_stats.upstream_queries;
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_tcp_proxy_stats(meshnow_tcp_proxy_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto proxy_stats = meshnow::tcp_proxy::getStats();
+    stats->connections = proxy_stats.connections;
+    stats->bytes_up = proxy_stats.bytes_up;
+    stats->bytes_down = proxy_stats.bytes_down;
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_handover_stats(meshnow_handover_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto netif_stats = meshnow::NowNetif::getStats();
+    stats->ip_handovers = netif_stats.handovers;
+    stats->ip_handover_outage_ms = netif_stats.handover_outage_ms;
+
+    auto parking_stats = meshnow::send::getParkingStats();
+    stats->frames_parked = parking_stats.parked;
+    stats->parked_frames_delivered = parking_stats.delivered;
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_broadcast_stats(meshnow_broadcast_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    auto netif_stats = meshnow::NowNetif::getStats();
+    stats->ip_broadcasts = netif_stats.broadcast_frames;
+    stats->arp_replies_proxied = netif_stats.arp_replies;
+    stats->broadcasts_suppressed = netif_stats.broadcasts_suppressed;
+
+    return ESP_OK;
+}
+
+extern "C" esp_err_t meshnow_get_queue_stats(meshnow_queue_stats_t* stats) {
+    if (!initialized) {
+        ESP_LOGE(TAG, "MeshNOW is not initialized!");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (stats == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stats->events_dropped = meshnow::event::Internal::droppedEvents();
+    stats->control_packets_dropped = meshnow::receive::droppedItems();
+    stats->data_packets_dropped = meshnow::data::droppedItems();
+
+    return ESP_OK;
+}
@@ -4,20 +4,31 @@
 #include <esp_check.h>
 #include <esp_log.h>
 #include <esp_netif.h>
+#include <esp_netif_net_stack.h>
 #include <esp_wifi.h>
 #include <lwip/ip4_addr.h>
 #include <lwip/lwip_napt.h>
+#include <lwip/netif.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <optional>
 
+#include "arp_proxy.hpp"
 #include "constants.hpp"
+#include "dns_cache.hpp"
 #include "event.hpp"
 #include "fragments.hpp"
+#include "header_compression.hpp"
 #include "lock.hpp"
-#include "packets.hpp"
 #include "send/queue.hpp"
 #include "state.hpp"
+#include "tcp_proxy.hpp"
 #include "util/mac.hpp"
+#include "util/pbuf.hpp"
 #include "util/task.hpp"
 #include "util/util.hpp"
 
@@ -28,6 +39,12 @@ static const char* TAG = CREATE_TAG("Netif");
 // use cloudflare 1.1.1.1 as DNS server
 static constexpr auto DNS_IP_ADDR = esp_netif_htonl(CONFIG_STATIC_DNS_ADDR);
 
+// IP packets larger than this are split up by the stack, TCP segments are sized to fit
+static constexpr uint16_t NETIF_MTU{CONFIG_NETIF_MTU};
+
+// nodes keep their IP address if they reach the root again within this time, e.g. after changing their parent
+static constexpr uint64_t HANDOVER_GRACE_PERIOD_US{static_cast<uint64_t>(CONFIG_HANDOVER_GRACE_PERIOD) * 1000};
+
 static const esp_netif_ip_info_t subnet_ip = {
     .ip = {.addr = ESP_IP4TOADDR(10, 0, 0, 1)},
     .netmask = {.addr = ESP_IP4TOADDR(255, 255, 0, 0)},
@@ -36,6 +53,14 @@ static const esp_netif_ip_info_t subnet_ip = {
 
 static util::Task io_receive_task_handle;
 
+static struct {
+    std::atomic<uint32_t> broadcast_frames;
+    std::atomic<uint32_t> arp_replies;
+    std::atomic<uint32_t> broadcasts_suppressed;
+    std::atomic<uint32_t> handovers;
+    std::atomic<uint32_t> handover_outage_ms;
+} stats;
+
 // forward declaration
 /**
  * Post attach callback for netif. Will configure IO function callbacks.
@@ -74,6 +99,19 @@ esp_err_t NowNetif::init() {
         }
     }
 
+    if (!state::isRoot()) {
+        esp_timer_create_args_t timer_args = {
+            .callback = &grace_timer_callback,
+            .arg = this,
+            .dispatch_method = ESP_TIMER_TASK,
+            .name = "netif_grace",
+            .skip_unhandled_events = true,
+        };
+        esp_timer_handle_t timer;
+        ESP_RETURN_ON_ERROR(esp_timer_create(&timer_args, &timer), TAG, "Failed to create grace timer");
+        grace_timer_.reset(timer);
+    }
+
     event_handler_instance_ = std::make_unique<util::EventHandlerInstance>(
         event::Internal::handle, event::MESHNOW_INTERNAL, static_cast<int32_t>(event::InternalEvent::STATE_CHANGED),
         &event_handler, this);
@@ -120,7 +158,12 @@ esp_err_t NowNetif::initRootSpecific() {
     // set dns & dhcp
     {
         esp_netif_dns_info_t dns;
+#if CONFIG_DNS_CACHE
+        // the root answers the queries of the nodes itself and only forwards the ones it has no answer for
+        dns.ip.u_addr.ip4.addr = subnet_ip.ip.addr;
+#else
         dns.ip.u_addr.ip4.addr = DNS_IP_ADDR;
+#endif
         dns.ip.type = ESP_IPADDR_TYPE_V4;
 
         ESP_LOGI(TAG, "Setting DHCP DNS to: %s", ip4addr_ntoa(reinterpret_cast<ip4_addr_t*>(&dns.ip.u_addr.ip4)));
@@ -144,12 +187,31 @@ esp_err_t NowNetif::initRootSpecific() {
 void NowNetif::start() {
     ESP_LOGI(TAG, "Starting network interface");
     esp_netif_action_start(netif_.get(), nullptr, 0, nullptr);
+    // starting adds the lwIP netif with the default Ethernet MTU, so it has to be set afterwards
+    // the lwIP netif belongs to the TCP/IP thread, so it is only touched from there
+    ESP_ERROR_CHECK(esp_netif_tcpip_exec(
+        [](void* ctx) -> esp_err_t {
+            auto* lwip_netif = static_cast<struct netif*>(esp_netif_get_netif_impl(static_cast<esp_netif_t*>(ctx)));
+            lwip_netif->mtu = NETIF_MTU;
+            return ESP_OK;
+        },
+        netif_.get()));
     ESP_ERROR_CHECK(io_receive_task_handle.init(
         util::TaskSettings("io_receive", 2048, TASK_PRIORITY, util::CPU::PRO_CPU), [&] { io_receive_task(); }));
 
     if (state::isRoot()) {
         // enable network address port translation AFTER starting the netif
         ip_napt_enable(subnet_ip.ip.addr, 1);
+#if CONFIG_DNS_CACHE
+        if (dns_cache::start(subnet_ip.ip.addr, DNS_IP_ADDR) != ESP_OK) {
+            ESP_LOGW(TAG, "DNS cache not available, nodes cannot resolve names");
+        }
+#endif
+#if CONFIG_TCP_PROXY
+        if (tcp_proxy::start(subnet_ip.ip.addr, subnet_ip.netmask.addr) != ESP_OK) {
+            ESP_LOGW(TAG, "TCP proxy not available, connections of the nodes pass through NAPT");
+        }
+#endif
     }
 
     started_ = true;
@@ -159,6 +221,15 @@ void NowNetif::start() {
 void NowNetif::stop() {
     ESP_LOGI(TAG, "Stopping network interface");
     io_receive_task_handle = util::Task();
+    {
+        std::lock_guard lock{handover_mutex_};
+        if (grace_timer_) esp_timer_stop(grace_timer_.get());
+        in_handover_ = false;
+    }
+    if (state::isRoot()) {
+        dns_cache::stop();
+        tcp_proxy::stop();
+    }
     esp_netif_action_stop(netif_.get(), nullptr, 0, nullptr);
     started_ = false;
     if (!state::isRoot()) {
@@ -169,6 +240,7 @@ void NowNetif::stop() {
 
 void NowNetif::deinit() {
     event_handler_instance_.reset();
+    grace_timer_.reset();
 
     if (state::isRoot()) {
         deinitRootSpecific();
@@ -178,7 +250,20 @@ void NowNetif::deinit() {
     netif_.reset();
 }
 
-void NowNetif::deinitRootSpecific() { ip_napt_enable(subnet_ip.ip.addr, 0); }
+void NowNetif::deinitRootSpecific() {
+    ip_napt_enable(subnet_ip.ip.addr, 0);
+    arp_proxy::reset();
+}
+
+NowNetif::Stats NowNetif::getStats() {
+    return Stats{
+        .broadcast_frames = stats.broadcast_frames,
+        .arp_replies = stats.arp_replies,
+        .broadcasts_suppressed = stats.broadcasts_suppressed,
+        .handovers = stats.handovers,
+        .handover_outage_ms = stats.handover_outage_ms,
+    };
+}
 
 // Handler to trigger connected/disconnected netif events
 void NowNetif::event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data) {
@@ -191,17 +276,57 @@ void NowNetif::event_handler(void* arg, esp_event_base_t event_base, int32_t eve
     // only trigger if netif is started
     if (!netif.started_) return;
 
+    std::lock_guard lock{netif.handover_mutex_};
+
     // connect when reaches root and disconnect again if not reaches root
     // this way no TCP data is transmitted if it could not even get to the root
     if (data.new_state == state::State::REACHES_ROOT) {
+        auto root_mac = state::getRootMac();
+        if (netif.in_handover_) {
+            esp_timer_stop(netif.grace_timer_.get());
+            netif.in_handover_ = false;
+            auto outage_ms = pdTICKS_TO_MS(xTaskGetTickCount() - netif.handover_started_);
+            stats.handover_outage_ms = outage_ms;
+
+            if (root_mac == netif.root_mac_) {
+                // the IP address and the leases and NAPT entries of the root are still valid
+                stats.handovers++;
+                ESP_LOGI(TAG, "Root reachable again after %lu ms, keeping IP address", outage_ms);
+                return;
+            }
+
+            // a different root has a different DHCP server, so the address has to be renewed
+            esp_netif_action_disconnected(netif.netif_.get(), nullptr, 0, nullptr);
+        }
+        netif.root_mac_ = root_mac;
         esp_netif_action_connected(netif.netif_.get(), nullptr, 0, nullptr);
         ESP_LOGI(TAG, "Triggered connected event");
     } else if (data.old_state == state::State::REACHES_ROOT) {
+        if (netif.grace_timer_ && HANDOVER_GRACE_PERIOD_US > 0) {
+            // most likely the node is just changing its parent, so only disconnect if that takes too long
+            netif.in_handover_ = true;
+            netif.handover_started_ = xTaskGetTickCount();
+            esp_timer_start_once(netif.grace_timer_.get(), HANDOVER_GRACE_PERIOD_US);
+            ESP_LOGI(TAG, "Root unreachable, keeping IP address for now");
+            return;
+        }
         esp_netif_action_disconnected(netif.netif_.get(), nullptr, 0, nullptr);
         ESP_LOGI(TAG, "Triggered disconnected event");
     }
 }
 
+void NowNetif::grace_timer_callback(void* arg) {
+    auto& netif = *static_cast<NowNetif*>(arg);
+
+    std::lock_guard lock{netif.handover_mutex_};
+    // the root may have become reachable right before
+    if (!netif.in_handover_) return;
+    netif.in_handover_ = false;
+
+    esp_netif_action_disconnected(netif.netif_.get(), nullptr, 0, nullptr);
+    ESP_LOGI(TAG, "Root still unreachable, triggered disconnected event");
+}
+
 // IO DRIVER
 
 [[noreturn]] void NowNetif::io_receive_task() {
@@ -214,9 +339,18 @@ void NowNetif::event_handler(void* arg, esp_event_base_t event_base, int32_t eve
         if (!data) continue;
 
         ESP_LOGV(TAG, "Got data!");
-        ESP_LOG_BUFFER_HEXDUMP(TAG, data->data(), data->size(), ESP_LOG_VERBOSE);
+        ESP_LOG_BUFFER_HEXDUMP(TAG, data->payload, data->tot_len, ESP_LOG_VERBOSE);
+
+        if (state::isRoot()) {
+            arp_proxy::learn(data.get());
+#if CONFIG_TCP_PROXY
+            tcp_proxy::redirect(data.get());
+#endif
+        }
 
-        ESP_ERROR_CHECK(esp_netif_receive(netif_.get(), data->data(), data->size(), nullptr));
+        // the stack takes ownership of the pbuf and hands it back to driver_free_rx_buffer once it is done with it
+        auto* p = data.release();
+        ESP_ERROR_CHECK(esp_netif_receive(netif_.get(), p->payload, p->tot_len, p));
 
         // cycle should take at least one tick as to not trigger the watchdog
         xTaskDelayUntil(&last_wake_time, 1);
@@ -224,84 +358,191 @@ void NowNetif::event_handler(void* arg, esp_event_base_t event_base, int32_t eve
 }
 
 /**
- * Fragment data into multiple fragments.
- * @param frag_id fragment id, will be used for all fragments
- * @param buffer pointer to the data to be sent, will be incremented
- * @param size_remaining size of the remaining data to be sent, will be decremented
- * @param frag_num current fragment number, will be incremented
- * @param total_size total size of the data to be sent
- * @return
+ * Recognizes pure TCP ACKs in IPv4 frames without options.
  */
-static meshnow::packets::DataFragment fragment(uint32_t frag_id, uint8_t*& buffer, size_t& size_remaining,
-                                               uint8_t& frag_num, uint16_t total_size) {
-    util::Buffer data;
-
-    if (size_remaining > MAX_FRAG_PAYLOAD_SIZE) {
-        data = util::Buffer{buffer, buffer + MAX_FRAG_PAYLOAD_SIZE};
-        size_remaining -= MAX_FRAG_PAYLOAD_SIZE;
-        buffer += MAX_FRAG_PAYLOAD_SIZE;
-    } else {
-        data = util::Buffer{buffer, buffer + size_remaining};
-        size_remaining = 0;
+static std::optional<send::PureAck> pureAck(const pbuf* frame) {
+    // Ethernet, IPv4 and TCP header without any data
+    std::array<uint8_t, 14 + 20 + 20> header;
+    if (frame->tot_len != header.size()) return std::nullopt;
+    pbuf_copy_partial(frame, header.data(), header.size(), 0);
+
+    const auto* ip = header.data() + 14;
+    const auto* tcp = ip + 20;
+    bool is_tcp = header[12] == 0x08 && header[13] == 0x00 && ip[0] == 0x45 && ip[9] == 6;
+    // data offset of 5 words means no options, flags must be exactly ACK
+    if (!is_tcp || tcp[12] != 0x50 || tcp[13] != 0x10) return std::nullopt;
+
+    send::PureAck ack;
+    std::copy(ip + 12, ip + 20, ack.flow.begin());
+    std::copy(tcp, tcp + 4, ack.flow.begin() + 8);
+    ack.ack = (static_cast<uint32_t>(tcp[8]) << 24) | (tcp[9] << 16) | (tcp[10] << 8) | tcp[11];
+    return ack;
+}
+
+/**
+ * Returns the client of a DHCP server reply, which only that node needs even if it is broadcast.
+ */
+static std::optional<util::MacAddr> dhcpClient(const pbuf* frame) {
+    // Ethernet, IPv4 without options, UDP and BOOTP up to the client hardware address
+    std::array<uint8_t, 14 + 20 + 8 + 34> header;
+    if (frame->tot_len < header.size()) return std::nullopt;
+    pbuf_copy_partial(frame, header.data(), header.size(), 0);
+
+    const auto* ip = header.data() + 14;
+    const auto* udp = ip + 20;
+    const auto* bootp = udp + 8;
+    bool is_udp = header[12] == 0x08 && header[13] == 0x00 && ip[0] == 0x45 && ip[9] == 17;
+    // from server port 67 to client port 68
+    if (!is_udp || udp[0] != 0 || udp[1] != 67 || udp[2] != 0 || udp[3] != 68) return std::nullopt;
+
+    return util::MacAddr{bootp + 28};
+}
+
+#if CONFIG_QOS
+/**
+ * Returns the class of an outgoing frame, from its DSCP or, if unmarked, from well-known ports.
+ * Both are the same for every frame of a flow, so a flow is never reordered by being split across classes.
+ */
+static packets::Priority classify(const pbuf* frame) {
+    // Ethernet, IPv4 with up to 40 bytes of options and the ports of TCP or UDP
+    std::array<uint8_t, 14 + 60 + 4> header{};
+    pbuf_copy_partial(frame, header.data(), std::min<size_t>(frame->tot_len, header.size()), 0);
+
+    // ARP and the like are needed before any other traffic can flow
+    const auto* ip = header.data() + 14;
+    if (header[12] != 0x08 || header[13] != 0x00 || ip[0] >> 4 != 4) return packets::Priority::INTERACTIVE;
+
+    auto dscp = ip[1] >> 2;
+    if (dscp != 0) {
+        // lower effort (RFC 8622) and CS1 are background traffic
+        if (dscp == 1) return packets::Priority::BULK;
+        switch (dscp >> 3) {
+            case 6:
+            case 7:
+                return packets::Priority::CONTROL;
+            case 3:
+            case 4:
+            case 5:
+                return packets::Priority::INTERACTIVE;
+            case 1:
+                return packets::Priority::BULK;
+            default:
+                return packets::Priority::BEST_EFFORT;
+        }
+    }
+
+    size_t ihl = (ip[0] & 0x0F) * 4;
+    bool has_ports = (ip[9] == 6 || ip[9] == 17) && frame->tot_len >= 14 + ihl + 4;
+    if (has_ports) {
+        const auto* ports = ip + ihl;
+        uint16_t src = (ports[0] << 8) | ports[1];
+        uint16_t dst = (ports[2] << 8) | ports[3];
+        // DNS, DHCP, NTP, MQTT and CoAP are short exchanges something is waiting for
+        for (uint16_t port : {53, 67, 68, 123, 1883, 8883, 5683, 5684}) {
+            if (src == port || dst == port) return packets::Priority::INTERACTIVE;
+        }
+    }
+
+    return packets::Priority::BEST_EFFORT;
+}
+#endif
+
+/**
+ * Hands the frame to the send worker, which fragments it once it is about to be sent.
+ * The headers are compressed per mesh endpoint if possible.
+ * Broadcasts of the root are avoided where the answer is already known or only a single node needs them.
+ */
+static void enqueueFrame(esp_netif_t* netif, util::PbufPtr frame) {
+#if CONFIG_TCP_PROXY
+    if (state::isRoot()) {
+        frame = tcp_proxy::restore(std::move(frame));
+        if (!frame) return;
+    }
+#endif
+
+    // the root transmits to the corresponding node, the nodes transmit to the root
+    auto dest_mac = state::isRoot() ? util::MacAddr{static_cast<uint8_t*>(frame->payload)} : util::MacAddr::root();
+
+    // only ARP and DHCP over IPv4 are handled here, anything else is sent as is
+    if (dest_mac.isBroadcast()) {
+        if (auto reply = arp_proxy::answer(frame.get())) {
+            // the stack takes ownership of the reply like of any received frame
+            stats.arp_replies++;
+            auto* p = reply.release();
+            esp_netif_receive(netif, p->payload, p->tot_len, p);
+            return;
+        }
+        if (auto client = dhcpClient(frame.get())) {
+            stats.broadcasts_suppressed++;
+            dest_mac = *client;
+        } else {
+            stats.broadcast_frames++;
+        }
     }
 
-    packets::DataFragment frag{
-        .frag_id = frag_id,
-        .options = {.unpacked =
-                        {
-                            .frag_num = frag_num,
-                            .total_size = total_size,
-                        }},
-        .data = std::move(data),
+    send::FrameInfo info{
+        .compressed = false,
+        .pure_ack = pureAck(frame.get()),
     };
 
-    frag_num++;
+#if CONFIG_QOS
+    info.priority = classify(frame.get());
+#endif
+
+    if (auto compressed_frame = header_compression::compress(dest_mac, frame.get())) {
+        frame = std::move(compressed_frame);
+        info.compressed = true;
+        info.carries_reference = header_compression::carriesReference(frame.get());
+        info.generation = header_compression::generationOf(frame.get());
+    }
 
-    return frag;
+    send::enqueueFrame(std::move(frame), send::FullyResolve(state::getThisMac(), dest_mac, state::getThisMac()), info);
+}
+
+static esp_netif_t* netifOf(esp_netif_iodriver_handle driver_handle) {
+    return static_cast<esp_netif_driver_base_t*>(driver_handle)->netif;
 }
 
 static esp_err_t transmit(esp_netif_iodriver_handle driver_handle, void* buffer, size_t len) {
     //    assert(len > 0 && len <= 1500 && "Invalid length");
 
-    util::MacAddr dest_mac{static_cast<uint8_t*>(buffer)};
-
-    uint32_t frag_id = esp_random();
-
-    auto* buffer8 = static_cast<uint8_t*>(buffer);
-    size_t size_remaining = len;
-    uint8_t frag_num = 0;
-
     ESP_LOGV(TAG, "Transmitting buffer of size %d", len);
     ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, len, ESP_LOG_VERBOSE);
 
-    while (size_remaining > 0) {
-        auto frag = fragment(frag_id, buffer8, size_remaining, frag_num, len);
-
-        if (state::isRoot()) {
-            // transmit to the corresponding node
-            send::enqueuePayload(std::move(frag),
-                                 send::FullyResolve(state::getThisMac(), dest_mac, state::getThisMac()));
-        } else {
-            // transmit to the root
-            send::enqueuePayload(std::move(frag),
-                                 send::FullyResolve(state::getThisMac(), util::MacAddr::root(), state::getThisMac()));
-        }
+    // without a pbuf of the stack we have to copy the data into our own
+    util::PbufPtr frame{pbuf_alloc(PBUF_RAW, len, PBUF_RAM)};
+    if (!frame) {
+        return ESP_ERR_NO_MEM;
     }
+    pbuf_take(frame.get(), buffer, len);
+
+    enqueueFrame(netifOf(driver_handle), std::move(frame));
 
     return ESP_OK;
 }
 
 static esp_err_t transmit_wrap(esp_netif_iodriver_handle driver_handle, void* buffer, size_t len,
                                void* netstack_buffer) {
-    // we simply call the non-wrap version. the normal wifi driver does this too. see <wifi_netif.c>/wifi_transmit_wrap
-    return transmit(driver_handle, buffer, len);
+    auto* p = static_cast<pbuf*>(netstack_buffer);
+
+    // the stack only passes single pbufs, but better be safe than sorry
+    if (p == nullptr || p->payload != buffer || p->len != len || p->tot_len != len) {
+        return transmit(driver_handle, buffer, len);
+    }
+
+    ESP_LOGV(TAG, "Transmitting pbuf of size %d", len);
+    ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, len, ESP_LOG_VERBOSE);
+
+    // keep the pbuf alive until all of its fragments are sent
+    enqueueFrame(netifOf(driver_handle), util::refPbuf(p));
+
+    return ESP_OK;
 }
 
 static void driver_free_rx_buffer(esp_netif_iodriver_handle driver_handle, void* buffer) {
-    // simply free
+    // buffer is the pbuf passed to esp_netif_receive as the driver's own buffer
     if (buffer) {
-        // TODO COULD BE A DOUBLE FREE
-        free(buffer);
+        pbuf_free(static_cast<pbuf*>(buffer));
     }
 }
 
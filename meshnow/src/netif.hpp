@@ -1,6 +1,7 @@
 #pragma once
 
 #include <esp_netif.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
 
 #include <memory>
@@ -9,6 +10,8 @@
 #include "event.hpp"
 #include "send/worker.hpp"
 #include "util/event.hpp"
+#include "util/mac.hpp"
+#include "util/mutex.hpp"
 
 namespace meshnow {
 
@@ -20,6 +23,21 @@ class NowNetif {
 
     using netif_ptr = std::unique_ptr<esp_netif_t, NetifDeleter>;
 
+    struct Stats {
+        // frames the stack sent to every node
+        uint32_t broadcast_frames;
+        // ARP requests of the root answered without asking the mesh
+        uint32_t arp_replies;
+        // broadcasts that were dropped or only sent towards the node that needs them
+        uint32_t broadcasts_suppressed;
+        // times the node reached the root again within the grace period, keeping its IP address
+        uint32_t handovers;
+        // how long the root was unreachable during the last handover
+        uint32_t handover_outage_ms;
+    };
+
+    static Stats getStats();
+
     esp_err_t init();
 
     void deinit();
@@ -47,6 +65,29 @@ class NowNetif {
 
     std::unique_ptr<util::EventHandlerInstance> event_handler_instance_;
 
+    static void grace_timer_callback(void* arg);
+
+    struct TimerDeleter {
+        void operator()(esp_timer_handle_t timer) const {
+            esp_timer_stop(timer);
+            esp_timer_delete(timer);
+        }
+    };
+
+    // disconnects the netif if the root stays unreachable for longer than the grace period
+    std::unique_ptr<std::remove_pointer_t<esp_timer_handle_t>, TimerDeleter> grace_timer_;
+
+    // guards the handover state, which is used by the event handler and the grace timer
+    util::Mutex handover_mutex_;
+
+    // the root is unreachable, but the netif is still connected
+    bool in_handover_{false};
+
+    TickType_t handover_started_{0};
+
+    // the root the IP address was assigned by
+    util::MacAddr root_mac_;
+
     bool started_{false};
 };
 
@@ -4,13 +4,19 @@
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <sdkconfig.h>
 
 #include "constants.hpp"
+#include "data/queue.hpp"
+#include "data/worker.hpp"
 #include "fragments.hpp"
+#include "header_compression.hpp"
 #include "job/runner.hpp"
 #include "netif.hpp"
 #include "receive/queue.hpp"
+#include "send/parking.hpp"
 #include "send/queue.hpp"
+#include "send/retransmit.hpp"
 #include "send/worker.hpp"
 #include "util/util.hpp"
 #include "util/waitbits.hpp"
@@ -21,12 +27,14 @@ namespace meshnow {
 
 static constexpr auto JOB_RUNNER_FINISHED_BIT = BIT0;
 static constexpr auto SEND_WORKER_FINISHED_BIT = BIT1;
+static constexpr auto DATA_WORKER_FINISHED_BIT = BIT2;
 
 esp_err_t Networking::init() {
     ESP_LOGI(TAG, "Initializing");
 
     ESP_RETURN_ON_ERROR(send::init(), TAG, "Failed to initialize send queue");
     ESP_RETURN_ON_ERROR(receive::init(), TAG, "Failed to initialize receive queue");
+    ESP_RETURN_ON_ERROR(data::init(), TAG, "Failed to initialize data plane queue");
     ESP_RETURN_ON_ERROR(task_waitbits_.init(), TAG, "Failed to initialize task waitbits");
     ESP_RETURN_ON_ERROR(fragments::init(), TAG, "Failed to initialize fragment reassembly");
     ESP_RETURN_ON_ERROR(netif_.init(), TAG, "Failed to initialize custom netif");
@@ -44,7 +52,11 @@ void Networking::deinit() {
     // reverse order of init
     netif_.deinit();
     fragments::deinit();
+    header_compression::reset();
+    data::deinit();
     receive::deinit();
+    send::forgetFrames();
+    send::forgetParked();
     send::deinit();
 }
 
@@ -74,6 +86,15 @@ esp_err_t Networking::start() {
                             TAG, "Failed to create send worker task");
     }
 
+    // start data worker, which may run on the other core to keep bulk forwarding away from the control plane
+    {
+        auto data_cpu = static_cast<util::CPU>(CONFIG_DATA_PLANE_CORE);
+        auto settings = util::TaskSettings{"data_worker", 5000, priority, data_cpu};
+        ESP_RETURN_ON_ERROR(data_worker_task_.init(settings, &data::worker_task, std::ref(stop_tasks_),
+                                                   std::ref(task_waitbits_), DATA_WORKER_FINISHED_BIT),
+                            TAG, "Failed to create data worker task");
+    }
+
     //    // init netif
     //    netif_->init();
     //
@@ -100,12 +121,14 @@ void Networking::stop() {
 
     stop_tasks_ = true;
 
-    // wait until both tasks are finished
-    task_waitbits_.wait(JOB_RUNNER_FINISHED_BIT | SEND_WORKER_FINISHED_BIT, true, true, portMAX_DELAY);
+    // wait until all tasks are finished
+    task_waitbits_.wait(JOB_RUNNER_FINISHED_BIT | SEND_WORKER_FINISHED_BIT | DATA_WORKER_FINISHED_BIT, true, true,
+                        portMAX_DELAY);
 
-    // reset both tasks
+    // reset all tasks
     job_runner_task_ = util::Task();
     send_worker_task_ = util::Task();
+    data_worker_task_ = util::Task();
 }
 
 }  // namespace meshnow
\ No newline at end of file
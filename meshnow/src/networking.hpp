@@ -41,6 +41,7 @@ class Networking {
     bool stop_tasks_{false};
     util::Task job_runner_task_;
     util::Task send_worker_task_;
+    util::Task data_worker_task_;
 
     NowNetif netif_;
 };
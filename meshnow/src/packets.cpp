@@ -15,11 +15,13 @@
 #include <vector>
 
 #include "constants.hpp"
+#include "short_id.hpp"
 
 namespace {
 
 using OutputAdapter = bitsery::OutputBufferAdapter<meshnow::util::Buffer>;
-using InputAdapter = bitsery::InputBufferAdapter<meshnow::util::Buffer>;
+// reads directly from raw memory, e.g. the buffer of the ESP-NOW receive callback
+using RawInputAdapter = bitsery::InputBufferAdapter<uint8_t[meshnow::MAX_FRAME_SIZE]>;
 
 }  // namespace
 
@@ -32,7 +34,8 @@ namespace ext {
 // Efficiently serialize data as we already encode the size of the data using other attributes
 class DataFragmentExtension {
    public:
-    DataFragmentExtension(uint16_t frag_num, uint16_t total_size) : frag_num(frag_num), total_size(total_size) {}
+    DataFragmentExtension(uint16_t frag_num, uint16_t total_size, bool large)
+        : frag_num(frag_num), total_size(total_size), unit(meshnow::packets::fragmentUnit(large)) {}
 
     template <typename Ser, typename Func>
     void serialize(Ser& ser, const meshnow::util::Buffer& data, Func&&) const {
@@ -44,21 +47,20 @@ class DataFragmentExtension {
     }
 
     inline void validateWrite(const meshnow::util::Buffer& data) const {
-        assert(data.size() <= meshnow::MAX_FRAG_PAYLOAD_SIZE && "Data too large");
-        //        assert(frag_num <= 6 && "Fragment number too large");
-        //        assert(total_size <= 1500 && "Total size too large");
-        assert(frag_num < (total_size + meshnow::MAX_FRAG_PAYLOAD_SIZE - 1) / meshnow::MAX_FRAG_PAYLOAD_SIZE &&
+        assert(data.size() <= unit && "Data too large");
+        assert((frag_num == meshnow::PARITY_FRAG_NUM || frag_num < (total_size + unit - 1) / unit) &&
                "Fragment number and total size mismatch");
     }
 
     template <typename Des, typename Func>
     void deserialize(Des& des, meshnow::util::Buffer& data, Func&&) const {
-        validateRead(des.adapter());
+        if (!validateRead(des.adapter())) return;
 
-        // if last fragment, only read the remaining size, otherwise read MAX_FRAG_PAYLOAD_SIZE
-        uint16_t to_read = total_size - (frag_num * meshnow::MAX_FRAG_PAYLOAD_SIZE);
-        if (to_read > meshnow::MAX_FRAG_PAYLOAD_SIZE) {
-            to_read = meshnow::MAX_FRAG_PAYLOAD_SIZE;
+        // if last fragment, only read the remaining size, otherwise read a whole unit
+        // the parity fragment is as large as the first fragment
+        uint16_t to_read = frag_num == meshnow::PARITY_FRAG_NUM ? total_size : total_size - (frag_num * unit);
+        if (to_read > unit) {
+            to_read = unit;
         }
 
         data.resize(to_read);
@@ -68,17 +70,55 @@ class DataFragmentExtension {
     }
 
     template <typename Reader>
-    inline void validateRead(Reader& r) const {
-        if (frag_num <= 6) return;
-        if (total_size <= 1500) return;
-        if ((frag_num + 1) * meshnow::MAX_FRAG_PAYLOAD_SIZE <= total_size) return;
+    inline bool validateRead(Reader& r) const {
+        if (frag_num == meshnow::PARITY_FRAG_NUM || frag_num * unit < total_size) return true;
 
         r.error(bitsery::ReaderError::InvalidData);
+        return false;
     }
 
    private:
     uint16_t frag_num;
     uint16_t total_size;
+    size_t unit;
+};
+
+// Frame size added after v1 as the last field of a packet
+// It is left out in the v1 form of the packet, which v1 nodes can read, and read as missing if the packet ends before it
+class FrameSizeExtension {
+   public:
+    template <typename Ser, typename Func>
+    void serialize(Ser& ser, const std::optional<uint16_t>& max_frame_size, Func&&) const {
+        if (max_frame_size) ser.value2b(*max_frame_size);
+    }
+
+    template <typename Des, typename Func>
+    void deserialize(Des& des, std::optional<uint16_t>& max_frame_size, Func&&) const {
+        if (des.adapter().isCompletedSuccessfully()) {
+            max_frame_size.reset();
+        } else {
+            des.value2b(max_frame_size.emplace());
+        }
+    }
+};
+
+// Credits added after v1 as the last field of a status
+// They are left out if unlimited, which is all a v1 node can read, and read as unlimited if the status ends before them
+class CreditsExtension {
+   public:
+    template <typename Ser, typename Func>
+    void serialize(Ser& ser, const uint8_t& credits, Func&&) const {
+        if (credits != meshnow::packets::UNLIMITED_CREDITS) ser.value1b(credits);
+    }
+
+    template <typename Des, typename Func>
+    void deserialize(Des& des, uint8_t& credits, Func&&) const {
+        if (des.adapter().isCompletedSuccessfully()) {
+            credits = meshnow::packets::UNLIMITED_CREDITS;
+        } else {
+            des.value1b(credits);
+        }
+    }
 };
 
 }  // namespace ext
@@ -93,6 +133,22 @@ struct ExtensionTraits<ext::DataFragmentExtension, meshnow::util::Buffer> {
     static constexpr bool SupportLambdaOverload = true;
 };
 
+template <>
+struct ExtensionTraits<ext::FrameSizeExtension, std::optional<uint16_t>> {
+    using TValue = uint16_t;
+    static constexpr bool SupportValueOverload = false;
+    static constexpr bool SupportObjectOverload = false;
+    static constexpr bool SupportLambdaOverload = true;
+};
+
+template <>
+struct ExtensionTraits<ext::CreditsExtension, uint8_t> {
+    using TValue = uint8_t;
+    static constexpr bool SupportValueOverload = false;
+    static constexpr bool SupportObjectOverload = false;
+    static constexpr bool SupportLambdaOverload = true;
+};
+
 }  // namespace traits
 
 }  // namespace bitsery
@@ -106,6 +162,7 @@ static void serialize(S& s, Status& p) {
     s.value1b(p.state);
     // TODO optimize with custom extension
     s.ext(p.root, bitsery::ext::StdOptional{});
+    s.ext(p.credits, bitsery::ext::CreditsExtension{}, [] {});
 }
 
 template <typename S>
@@ -119,13 +176,14 @@ static void serialize(S&, SearchReply&) {
 }
 
 template <typename S>
-static void serialize(S&, ConnectRequest&) {
-    // no data
+static void serialize(S& s, ConnectRequest& p) {
+    s.ext(p.max_frame_size, bitsery::ext::FrameSizeExtension{}, [] {});
 }
 
 template <typename S>
 static void serialize(S& s, ConnectOk& p) {
     s.object(p.root);
+    s.ext(p.max_frame_size, bitsery::ext::FrameSizeExtension{}, [] {});
 }
 
 template <typename S>
@@ -152,7 +210,9 @@ template <typename S>
 static void serialize(S& s, DataFragment& p) {
     s.value4b(p.frag_id);
     s.value2b(p.options.packed);
-    s.ext(p.data, bitsery::ext::DataFragmentExtension{p.options.unpacked.frag_num, p.options.unpacked.total_size},
+    s.ext(p.data,
+          bitsery::ext::DataFragmentExtension{p.options.unpacked.frag_num, p.options.unpacked.total_size,
+                                              static_cast<bool>(p.options.unpacked.large)},
           [] {});
 }
 
@@ -161,6 +221,34 @@ static void serialize(S& s, CustomData& p) {
     s.container1b(p.data, MAX_CUSTOM_PAYLOAD_SIZE);
 }
 
+template <typename S>
+static void serialize(S& s, Aggregate& p) {
+    s.container1b(p.data, MAX_AGGREGATE_DATA_SIZE);
+}
+
+template <typename S>
+static void serialize(S& s, ShortIdAssign& p) {
+    s.object(p.node);
+    s.value2b(p.short_id);
+}
+
+template <typename S>
+static void serialize(S& s, CompressionNack& p) {
+    s.value1b(p.flow_id);
+}
+
+template <typename S>
+static void serialize(S& s, FragmentNack& p) {
+    s.value4b(p.frag_id);
+    s.value1b(p.missing);
+}
+
+template <typename S>
+static void serialize(S& s, ShortIdConfirm& p) {
+    s.object(p.node);
+    s.value2b(p.short_id);
+}
+
 }  // namespace meshnow::packets
 
 // HELPER SERIALIZERS //
@@ -179,6 +267,23 @@ void serialize(S& s, FullPacket& fp) {
     s.object(fp.packet);
 }
 
+// compact packet with a version byte, a shorter id and short IDs instead of MAC addresses
+struct CompactPacket {
+    uint8_t version;
+    uint16_t id;
+    meshnow::packets::ShortAddrs addrs;
+    meshnow::packets::Payload payload;
+};
+
+template <typename S>
+void serialize(S& s, CompactPacket& cp) {
+    s.value1b(cp.version);
+    s.value2b(cp.id);
+    s.value2b(cp.addrs.from);
+    s.value2b(cp.addrs.to);
+    s.ext(cp.payload, bitsery::ext::StdVariant{[](S& s, auto& p) { s.object(p); }});
+}
+
 }  // namespace
 
 namespace meshnow::util {
@@ -206,13 +311,24 @@ static void serialize(S& s, Packet& p) {
 
 namespace meshnow::packets {
 
-util::Buffer serialize(const Packet& packet) {
-    util::Buffer buffer;
+/**
+ * Writes the packet with either a full or a compact header.
+ */
+static size_t write(util::Buffer& buffer, const Packet& packet, const std::optional<ShortAddrs>& short_addrs) {
+    if (short_addrs) {
+        CompactPacket cp{COMPACT_HEADER_VERSION, static_cast<uint16_t>(packet.id), *short_addrs, packet.payload};
+        return bitsery::quickSerialization(OutputAdapter{buffer}, cp);
+    } else {
+        FullPacket fp{MAGIC, packet};
+        return bitsery::quickSerialization(OutputAdapter{buffer}, fp);
+    }
+}
 
-    FullPacket fp{MAGIC, packet};
+util::Buffer serialize(const Packet& packet, const std::optional<ShortAddrs>& short_addrs) {
+    util::Buffer buffer;
 
     // write
-    auto written_size = bitsery::quickSerialization(OutputAdapter{buffer}, fp);
+    auto written_size = write(buffer, packet, short_addrs);
 
     // shrink and return
     buffer.resize(written_size);
@@ -220,11 +336,53 @@ util::Buffer serialize(const Packet& packet) {
     return buffer;
 }
 
-std::optional<Packet> deserialize(const util::Buffer& buffer) {
+util::Buffer serializeFragment(uint32_t id, const util::MacAddr& from, const util::MacAddr& to, uint32_t frag_id,
+                               uint8_t frag_num, uint16_t total_size, bool large, bool compressed, const uint8_t* data,
+                               size_t size, const std::optional<ShortAddrs>& short_addrs) {
+    util::Buffer buffer;
+    buffer.reserve(headerSize(short_addrs) + FRAG_HEADER_SIZE + size);
+
+    // serialize everything but the data itself
+    DataFragment fragment{
+        .frag_id = frag_id,
+        .options = {.unpacked =
+                        {
+                            .frag_num = frag_num,
+                            .total_size = total_size,
+                            .large = large,
+                            .compressed = compressed,
+                        }},
+        .data = {},
+    };
+    auto written_size = write(buffer, Packet{id, from, to, std::move(fragment)}, short_addrs);
+    buffer.resize(written_size);
+
+    // the data is written last and without a size prefix, so it can be appended directly
+    buffer.insert(buffer.end(), data, data + size);
+    return buffer;
+}
+
+static std::optional<Packet> deserializeCompact(const uint8_t* data, size_t size) {
+    CompactPacket cp;
+
+    auto [error, red_everything] = bitsery::quickDeserialization(RawInputAdapter{data, size}, cp);
+    if (error != bitsery::ReaderError::NoError || !red_everything) return std::nullopt;
+
+    // only known short IDs can be turned back into addresses
+    auto from = short_id::resolve(cp.addrs.from);
+    auto to = short_id::resolve(cp.addrs.to);
+    if (!from || !to) return std::nullopt;
+
+    return Packet{cp.id, *from, *to, std::move(cp.payload)};
+}
+
+std::optional<Packet> deserialize(const uint8_t* data, size_t size) {
+    if (size > 0 && data[0] == COMPACT_HEADER_VERSION) return deserializeCompact(data, size);
+
     FullPacket fp;
 
     // read
-    auto [error, red_everything] = bitsery::quickDeserialization(InputAdapter{buffer.begin(), buffer.size()}, fp);
+    auto [error, red_everything] = bitsery::quickDeserialization(RawInputAdapter{data, size}, fp);
 
     // check for errors
     if (error == bitsery::ReaderError::NoError && red_everything && fp.magic == MAGIC) {
@@ -234,4 +392,32 @@ std::optional<Packet> deserialize(const util::Buffer& buffer) {
     }
 }
 
-}  // namespace meshnow::packets
\ No newline at end of file
+bool appendToAggregate(Aggregate& aggregate, const util::Buffer& packet) {
+    if (packet.size() > UINT8_MAX) return false;
+    if (aggregate.data.size() + 1 + packet.size() > MAX_AGGREGATE_DATA_SIZE) return false;
+
+    aggregate.data.push_back(packet.size());
+    aggregate.data.insert(aggregate.data.end(), packet.begin(), packet.end());
+    return true;
+}
+
+std::vector<Packet> unpackAggregate(const Aggregate& aggregate) {
+    std::vector<Packet> packets;
+
+    size_t offset = 0;
+    while (offset < aggregate.data.size()) {
+        size_t size = aggregate.data[offset++];
+        if (offset + size > aggregate.data.size()) break;
+
+        // nested aggregates are not allowed
+        auto packet = deserialize(aggregate.data.data() + offset, size);
+        if (packet && !std::holds_alternative<Aggregate>(packet->payload)) {
+            packets.push_back(std::move(*packet));
+        }
+        offset += size;
+    }
+
+    return packets;
+}
+
+}  // namespace meshnow::packets
@@ -3,26 +3,39 @@
 #include <cstdint>
 #include <optional>
 #include <variant>
+#include <vector>
 
+#include "constants.hpp"
 #include "state.hpp"
 #include "util/mac.hpp"
 #include "util/util.hpp"
 
 namespace meshnow::packets {
 
+// credits advertised by nodes that do not limit what their neighbors send
+constexpr uint8_t UNLIMITED_CREDITS{0xFF};
+
 struct Status {
     state::State state;
     std::optional<util::MacAddr> root;
+    // frames the receiver may send to this node until the next status, not counting control packets
+    // added after v1 and left out if unlimited, so that v1 nodes can still read the status
+    uint8_t credits;
 };
 
 struct SearchProbe {};
 
 struct SearchReply {};
 
-struct ConnectRequest {};
+struct ConnectRequest {
+    // largest frame the sender can receive, left out by v1 nodes and in the v1 form of the request
+    std::optional<uint16_t> max_frame_size;
+};
 
 struct ConnectOk {
     util::MacAddr root;
+    // largest frame both sides can receive, left out towards nodes that asked in the v1 form
+    std::optional<uint16_t> max_frame_size;
 };
 
 struct RoutingTableAdd {
@@ -45,19 +58,88 @@ struct DataFragment {
         struct {
             uint16_t frag_num : 3;
             uint16_t total_size : 11;
-            uint16_t : 2;  // unused
+            // fragment numbers count in units of LARGE_FRAG_PAYLOAD_SIZE instead of MAX_FRAG_PAYLOAD_SIZE
+            uint16_t large : 1;
+            // the reassembled data is an IP frame with compressed headers
+            uint16_t compressed : 1;
         } unpacked;
         uint16_t packed;
     } options;
     util::Buffer data;
 };
 
+/**
+ * Priority class of a packet. Every hop serves the packets for a neighbor strictly in this order.
+ */
+enum class Priority : uint8_t {
+    // bulk transfers like firmware downloads
+    BULK = 0,
+    BEST_EFFORT = 1,
+    // latency sensitive traffic like MQTT or DNS
+    INTERACTIVE = 2,
+    // network control, including the control packets of the mesh itself
+    CONTROL = 3,
+};
+
+constexpr size_t NUM_PRIORITIES{4};
+
+/**
+ * The two most significant bits of a fragment ID carry the priority class of the IP frame, so every hop can schedule
+ * its fragments without reassembling it. Nodes that do not know about this pick random bits there.
+ */
+constexpr Priority fragmentPriority(uint32_t frag_id) { return static_cast<Priority>(frag_id >> 30); }
+
+constexpr uint32_t withPriority(uint32_t frag_id, Priority priority) {
+    return (frag_id & 0x3FFFFFFF) | static_cast<uint32_t>(priority) << 30;
+}
+
 struct CustomData {
     util::Buffer data;
 };
 
+/**
+ * Several small packets for the same next hop, sent in a single frame.
+ */
+struct Aggregate {
+    // the serialized packets, each prefixed by its size in one byte
+    util::Buffer data;
+};
+
+/**
+ * Announces the short ID the root assigned to a node, sent hop by hop from the root to the node.
+ */
+struct ShortIdAssign {
+    util::MacAddr node;
+    uint16_t short_id;
+};
+
+/**
+ * Confirms a ShortIdAssign to the hop it came from, which only then uses the ID in compact headers towards this node.
+ */
+struct ShortIdConfirm {
+    util::MacAddr node;
+    uint16_t short_id;
+};
+
+/**
+ * Tells the sender of a compressed IP frame that the header reference of the flow is unknown, so it resends it.
+ */
+struct CompressionNack {
+    uint8_t flow_id;
+};
+
+/**
+ * Asks the source of an incomplete IP frame to resend the fragments that have not arrived.
+ */
+struct FragmentNack {
+    uint32_t frag_id;
+    // each bit corresponds to a missing regular fragment
+    uint8_t missing;
+};
+
 using Payload = std::variant<Status, SearchProbe, SearchReply, ConnectRequest, ConnectOk, RoutingTableAdd,
-                             RoutingTableRemove, RootUnreachable, RootReachable, DataFragment, CustomData>;
+                             RoutingTableRemove, RootUnreachable, RootReachable, DataFragment, CustomData, Aggregate,
+                             ShortIdAssign, CompressionNack, FragmentNack, ShortIdConfirm>;
 
 struct Packet {
     uint32_t id;
@@ -66,19 +148,76 @@ struct Packet {
     Payload payload;
 };
 
+/**
+ * Short IDs replacing the from and to fields in a compact header.
+ */
+struct ShortAddrs {
+    uint16_t from;
+    uint16_t to;
+};
+
 /**
  * Serialize the given packet into a byte buffer
  * @param packet The packet to serialize
+ * @param short_addrs If set, a compact header with these short IDs and a 16-bit id is written
  * @return The serialized packet as a byte buffer
  */
-util::Buffer serialize(const Packet& packet);
+util::Buffer serialize(const Packet& packet, const std::optional<ShortAddrs>& short_addrs = std::nullopt);
 
 /**
- * Deserialize the given byte buffer into a packet
- * @param buffer The byte buffer to deserialize
- * @return The deserialized packet. If the buffer is invalid,
+ * Serialize a data fragment directly from raw bytes, without copying them into a DataFragment first
+ * @param id The id of the packet
+ * @param from The from field of the packet
+ * @param to The to field of the packet
+ * @param frag_id Random ID to identify which fragments belong together
+ * @param frag_num Number of this fragment in the sequence of fragments
+ * @param total_size Total size of the data over all fragments in bytes
+ * @param large Whether this is a large fragment
+ * @param compressed Whether the fragmented IP frame has compressed headers
+ * @param data Pointer to the data of this fragment
+ * @param size Size of the data of this fragment
+ * @param short_addrs If set, a compact header with these short IDs is written
+ * @return The serialized packet as a byte buffer
+ */
+util::Buffer serializeFragment(uint32_t id, const util::MacAddr& from, const util::MacAddr& to, uint32_t frag_id,
+                               uint8_t frag_num, uint16_t total_size, bool large, bool compressed, const uint8_t* data,
+                               size_t size, const std::optional<ShortAddrs>& short_addrs = std::nullopt);
+
+/**
+ * Deserialize the given raw bytes into a packet
+ * @param data Pointer to the bytes to deserialize
+ * @param size Number of bytes
+ * @return The deserialized packet. If the bytes are invalid or the short IDs of a compact header are unknown,
  * std::nullopt is returned
  */
-std::optional<Packet> deserialize(const util::Buffer& buffer);
+std::optional<Packet> deserialize(const uint8_t* data, size_t size);
+
+/**
+ * Returns true iff the given serialized packet has a compact header.
+ */
+inline bool isCompact(const util::Buffer& buffer) { return !buffer.empty() && buffer[0] == COMPACT_HEADER_VERSION; }
+
+/**
+ * Returns the size of the header written for the given short IDs.
+ */
+constexpr size_t headerSize(const std::optional<ShortAddrs>& short_addrs) {
+    return short_addrs ? COMPACT_HEADER_SIZE : HEADER_SIZE;
+}
+
+/**
+ * Appends a serialized packet to an aggregate
+ * @return false if the packet does not fit into the aggregate anymore
+ */
+bool appendToAggregate(Aggregate& aggregate, const util::Buffer& packet);
+
+/**
+ * Splits an aggregate back into its packets. Packets that cannot be deserialized are skipped.
+ */
+std::vector<Packet> unpackAggregate(const Aggregate& aggregate);
+
+/**
+ * Returns the payload size of the fragments of the given size class
+ */
+constexpr size_t fragmentUnit(bool large) { return large ? LARGE_FRAG_PAYLOAD_SIZE : MAX_FRAG_PAYLOAD_SIZE; }
 
 }  // namespace meshnow::packets
@@ -1,20 +1,36 @@
 #include "queue.hpp"
 
+#include <esp_log.h>
+
+#include <atomic>
+
 #include "util/queue.hpp"
+#include "util/util.hpp"
 
 static constexpr auto QUEUE_SIZE{32};
-// TODO QUEUE_SIZE has to be higher so not to get deadlocks! FIND A REAL SOLUTION!
 
 namespace meshnow::receive {
 
+static constexpr auto TAG = CREATE_TAG("ReceiveQueue");
+
 static util::Queue<Item> queue;
 
+static std::atomic<uint32_t> dropped_items{0};
+
 esp_err_t init() { return queue.init(QUEUE_SIZE); }
 
 void deinit() { queue = util::Queue<Item>{}; }
 
-void push(Item&& item) { queue.push_back(std::move(item), portMAX_DELAY); }
+void push(Item&& item) {
+    // called from the Wi-Fi task, which must never block, control packets are sent again by their source anyway
+    if (!queue.push_back(std::move(item), 0)) {
+        ESP_LOGD(TAG, "Receive queue full, dropping packet");
+        dropped_items++;
+    }
+}
 
 std::optional<Item> pop(TickType_t timeout) { return queue.pop(timeout); }
 
+uint32_t droppedItems() { return dropped_items; }
+
 }  // namespace meshnow::receive
\ No newline at end of file
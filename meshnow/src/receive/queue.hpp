@@ -31,7 +31,7 @@ esp_err_t init();
 void deinit();
 
 /**
- * Pushes a new item to the receive queue.
+ * Pushes a new item to the receive queue, or drops it if the queue is full.
  *
  * @param item Item to push.
  */
@@ -45,4 +45,9 @@ void push(Item&& item);
  */
 std::optional<Item> pop(TickType_t timeout);
 
+/**
+ * Returns the number of items that were dropped because the receive queue was full.
+ */
+uint32_t droppedItems();
+
 }  // namespace meshnow::receive
\ No newline at end of file
@@ -2,20 +2,27 @@
 
 #include <esp_log.h>
 
+#include <algorithm>
+
+#include "data/queue.hpp"
 #include "packets.hpp"
 #include "queue.hpp"
+#include "state.hpp"
 
 namespace meshnow::receive {
 
-void Receiver::receiveCallback(const esp_now_recv_info_t *esp_now_info, const uint8_t *data, int data_len) {
-    // convert raw data pointer into buffer (vector) for deserialization TODO avoid this
-    std::vector<uint8_t> buffer(data, data + data_len);
-
-    //    ESP_LOGI("TEST", "RECEIVED DATA");
-    //    ESP_LOG_BUFFER_HEXDUMP("TEST", buffer.data(), buffer.size(), ESP_LOG_INFO);
+static void dispatch(Item&& item) {
+    // forwarding and data fragments are handled by the data plane, everything else by the job runner
+    if (!state::isForMe(item.packet.to) || std::holds_alternative<packets::DataFragment>(item.packet.payload)) {
+        data::push(std::move(item));
+    } else {
+        push(std::move(item));
+    }
+}
 
-    // deserialize
-    auto packet = packets::deserialize(buffer);
+void Receiver::receiveCallback(const esp_now_recv_info_t *esp_now_info, const uint8_t *data, int data_len) {
+    // deserialize straight from the driver's buffer
+    auto packet = packets::deserialize(data, data_len);
 
     // if deserialization failed, ignore
     // could happen because of interference with connecting to a router
@@ -24,15 +31,35 @@ void Receiver::receiveCallback(const esp_now_recv_info_t *esp_now_info, const ui
         return;
     }
 
-    // create item
-    Item item{
-        util::MacAddr(esp_now_info->src_addr),
-        esp_now_info->rx_ctrl->rssi,
-        std::move(*packet),
+    util::MacAddr from{esp_now_info->src_addr};
+    int rssi = esp_now_info->rx_ctrl->rssi;
+
+    // only unicast frames are retransmitted, and a node never sends two different frames with the same id
+    if (!util::MacAddr{esp_now_info->des_addr}.isBroadcast() && isDuplicate(from, packet->id, data_len)) {
+        ESP_LOGV("TAG", "Dropping retransmitted duplicate from " MACSTR, MAC2STR(from));
+        return;
+    }
+
+    // handle the packets of an aggregate as if they were received one by one
+    if (auto *aggregate = std::get_if<packets::Aggregate>(&packet->payload)) {
+        for (auto &inner : packets::unpackAggregate(*aggregate)) {
+            dispatch(Item{from, rssi, std::move(inner)});
+        }
+        return;
+    }
+
+    dispatch(Item{from, rssi, std::move(*packet)});
+}
+
+bool Receiver::isDuplicate(const util::MacAddr &from, uint32_t id, uint16_t size) {
+    auto matches = [&](const Received &received) {
+        return received.id == id && received.size == size && received.from == from;
     };
+    if (std::any_of(recent_.begin(), recent_.end(), matches)) return true;
 
-    // push item to queue
-    push(std::move(item));
+    recent_[next_] = Received{from, id, size};
+    next_ = (next_ + 1) % DUPLICATE_WINDOW;
+    return false;
 }
 
 }  // namespace meshnow::receive
@@ -1,13 +1,39 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <espnow_multi.hpp>
 
+#include "util/mac.hpp"
+
 namespace meshnow::receive {
 
 class Receiver : public espnow_multi::EspnowReceiver {
    public:
     // deserializes the item and if successful, puts it into the queue
     void receiveCallback(const esp_now_recv_info_t* esp_now_info, const uint8_t* data, int data_len) override;
+
+   private:
+    // number of recently received unicast frames that a retransmission is compared against
+    static constexpr size_t DUPLICATE_WINDOW{32};
+
+    struct Received {
+        util::MacAddr from;
+        uint32_t id;
+        // compact headers only carry 16 bits of the id, so the size tells more frames apart
+        uint16_t size;
+    };
+
+    /**
+     * Returns true iff the frame was already received, and remembers it otherwise.
+     * The sender retransmits a frame whose acknowledgement got lost, although it was received.
+     */
+    bool isDuplicate(const util::MacAddr& from, uint32_t id, uint16_t size);
+
+    // only accessed from the Wi-Fi task
+    std::array<Received, DUPLICATE_WINDOW> recent_{};
+    size_t next_{0};
 };
 
 }  // namespace meshnow::receive
\ No newline at end of file
@@ -58,6 +58,8 @@ void DownstreamRetry::send(SendSink& sink) {
             }
         }
         failed_ = std::move(new_failed);
+        // keep trying until every child took it, the item is dropped once its deadline has passed
+        if (!failed_.empty()) sink.requeue();
     }
 }
 
@@ -115,12 +117,13 @@ void FullyResolve::broadcast(SendSink& sink) {
     } else {
         std::vector<util::MacAddr> new_failed;
         for (const auto& mac : broadcast_failed_) {
-            if (!layout.hasChild(mac) || !(layout.hasParent() && layout.getParent().mac == mac)) continue;
+            if (!layout.hasChild(mac) && !(layout.hasParent() && layout.getParent().mac == mac)) continue;
             if (!sink.accept(mac, from, to)) {
                 new_failed.push_back(mac);
             }
         }
         broadcast_failed_ = std::move(new_failed);
+        if (!broadcast_failed_.empty()) sink.requeue();
     }
 }
 
@@ -157,11 +160,15 @@ void FullyResolve::child(SendSink& sink) {
     auto child = std::find_if(children.begin(), children.end(),
                               [&](const layout::Child& child) { return child.mac == to || inRoutingTable(child, to); });
 
-    if (child != children.end()) {
+    // a child that passes the packet back up no longer has the target below it, its removal is on the way
+    if (child != children.end() && child->mac != prev_hop) {
         // send downstream to child
         if (!sink.accept(child->mac, from, to)) {
             sink.requeue();
         }
+    } else if (state::isRoot()) {
+        // the target is not in the mesh right now, but may just be changing its parent
+        sink.park(to);
     } else {
         // send upstream to parent
         parent(sink);
@@ -24,9 +24,14 @@ class SendSink {
     virtual bool accept(const util::MacAddr& next_hop, const util::MacAddr& from, const util::MacAddr& to) = 0;
 
     /**
-     * Retries later.
+     * Retries later, with the state the behavior kept about the next hops it is done with.
      */
     virtual void requeue() = 0;
+
+    /**
+     * Holds the packet back until the given node is reachable again.
+     */
+    virtual void park(const util::MacAddr& to) = 0;
 };
 
 class DirectOnce {
@@ -0,0 +1,417 @@
+#include "hop_queues.hpp"
+
+#include <esp_random.h>
+#include <sdkconfig.h>
+
+#include <algorithm>
+#include <cmath>
+
+#include "constants.hpp"
+#include "packets.hpp"
+#include "state.hpp"
+
+namespace meshnow::send {
+
+// maximum number of frames queued per next hop
+static constexpr auto HOP_QUEUE_SIZE = CONFIG_SEND_HOP_QUEUE_SIZE;
+
+// bytes credited to a hop per round, at least one full frame so that every round serves every busy hop
+static constexpr size_t QUANTUM{MAX_FRAME_SIZE};
+
+// how long small packets may be held back to be aggregated with others
+static constexpr auto AGGREGATION_BUDGET = pdMS_TO_TICKS(CONFIG_AGGREGATION_BUDGET_MS);
+
+// packets of at most this size are aggregated, so that at least two fit into one aggregate
+static constexpr size_t MAX_SMALL_SIZE{MAX_AGGREGATE_DATA_SIZE / 2 - 1};
+
+// an aggregate is sent right away once its packets fill at least this much
+static constexpr size_t AGGREGATE_FILL_TARGET{MAX_AGGREGATE_DATA_SIZE / 2};
+
+#if CONFIG_CODEL
+// IP traffic waiting longer than this in a hop queue counts as standing queue
+static constexpr auto CODEL_TARGET = pdMS_TO_TICKS(CONFIG_CODEL_TARGET_MS);
+
+// how long the delay may stay above the target before dropping starts, about a round trip through the mesh
+static constexpr auto CODEL_INTERVAL = pdMS_TO_TICKS(CONFIG_CODEL_INTERVAL_MS);
+#endif
+
+static bool isStarted(const HopQueues::Entry& entry) {
+    auto* ip_frame = std::get_if<IpFrame>(&entry);
+    return ip_frame && ip_frame->isStarted();
+}
+
+bool HopQueues::coalesce(Hop& hop, Entry& entry, const Coalescable& coalescable) {
+    for (auto& queued : hop.frames) {
+        auto& other = queued.coalescable;
+        if (!other || other->kind != coalescable.kind || other->to != coalescable.to) continue;
+
+        // a requeued packet may be older than the queued one
+        if (static_cast<int32_t>(coalescable.seq - other->seq) > 0) {
+            queued.entry = std::move(entry);
+            other->seq = coalescable.seq;
+        }
+        coalesced_++;
+        return true;
+    }
+    return false;
+}
+
+bool HopQueues::push(const util::MacAddr& next_hop, Entry entry, packets::Priority priority,
+                     std::optional<uint32_t> frag_id, std::optional<Coalescable> coalescable,
+                     std::optional<TickType_t> deadline) {
+    auto& hop = getOrCreate(next_hop);
+    if (coalescable && coalesce(hop, entry, *coalescable)) return true;
+
+    if (hop.frames.size() >= HOP_QUEUE_SIZE) {
+        // the queue is sorted by class, so the last entry is of the lowest one
+        auto& last = hop.frames.back();
+        if (last.priority >= priority || isStarted(last.entry)) return false;
+        hop.frames.pop_back();
+        evicted_++;
+    }
+
+    auto position = std::find_if(hop.frames.begin(), hop.frames.end(),
+                                 [&](const Queued& queued) { return queued.priority < priority; });
+    hop.frames.insert(position, Queued{std::move(entry), xTaskGetTickCount(), priority, frag_id, coalescable, deadline});
+    return true;
+}
+
+bool HopQueues::supersedeAck(const util::MacAddr& next_hop, IpFrame& frame) {
+    auto& new_ack = frame.pureAck();
+    if (!new_ack) return false;
+
+    auto hop = std::find_if(hops_.begin(), hops_.end(), [&](const Hop& hop) { return hop.next_hop == next_hop; });
+    if (hop == hops_.end()) return false;
+
+    // look at the most recently queued ACK of the flow
+    for (auto it = hop->frames.rbegin(); it != hop->frames.rend(); ++it) {
+        auto* ip_frame = std::get_if<IpFrame>(&it->entry);
+        if (!ip_frame || ip_frame->isStarted()) continue;
+
+        auto& old_ack = ip_frame->pureAck();
+        if (!old_ack || old_ack->flow != new_ack->flow) continue;
+
+        // only a strictly newer cumulative ACK makes the queued one redundant
+        if (static_cast<int32_t>(new_ack->ack - old_ack->ack) <= 0) return false;
+
+        // the headers were compressed before queueing: the frames after a new reference need it, and a delta can only
+        // be restored with the reference of its own generation
+        auto& old_info = ip_frame->info();
+        auto& new_info = frame.info();
+        if (old_info.compressed != new_info.compressed) return false;
+        if (old_info.compressed && (old_info.carries_reference || old_info.generation != new_info.generation)) {
+            return false;
+        }
+
+        *ip_frame = std::move(frame);
+        return true;
+    }
+    return false;
+}
+
+static size_t nextSize(const HopQueues::Entry& entry) {
+    if (auto* ip_frame = std::get_if<IpFrame>(&entry)) {
+        return ip_frame->nextSize();
+    }
+    return std::get<util::Buffer>(entry).size();
+}
+
+/**
+ * Takes the next frame from the front entry, removing the entry once it is exhausted.
+ */
+static util::Buffer takeNext(std::deque<HopQueues::Queued>& frames) {
+    util::Buffer buffer;
+    if (auto* ip_frame = std::get_if<IpFrame>(&frames.front().entry)) {
+        buffer = ip_frame->cutNext();
+        if (!ip_frame->isDone()) return buffer;
+    } else {
+        buffer = std::move(std::get<util::Buffer>(frames.front().entry));
+    }
+    frames.pop_front();
+    return buffer;
+}
+
+static bool isSmall(size_t size) { return size <= MAX_SMALL_SIZE; }
+
+/**
+ * Returns when the packet that waits the longest was enqueued, which is not necessarily the first one.
+ */
+static TickType_t oldestEnqueuedAt(const HopQueues::Hop& hop, TickType_t now) {
+    TickType_t oldest = hop.frames.front().enqueued_at;
+    for (const auto& queued : hop.frames) {
+        if (now - queued.enqueued_at > now - oldest) oldest = queued.enqueued_at;
+    }
+    return oldest;
+}
+
+/**
+ * A hop is held back while it only has a few small packets whose budget has not run out yet.
+ */
+static bool isHeld(const HopQueues::Hop& hop, TickType_t now) {
+    if (AGGREGATION_BUDGET == 0) return false;
+    if (now - oldestEnqueuedAt(hop, now) >= AGGREGATION_BUDGET) return false;
+
+    size_t fill = 0;
+    for (const auto& queued : hop.frames) {
+        auto size = nextSize(queued.entry);
+        if (!isSmall(size)) return false;
+        fill += 1 + size;
+    }
+    return fill < AGGREGATE_FILL_TARGET;
+}
+
+/**
+ * Control packets are always sent, everything else needs credits of the neighbor.
+ */
+static bool hasCredits(const HopQueues::Hop& hop) {
+    return !hop.credits || *hop.credits > 0 || hop.frames.front().priority == packets::Priority::CONTROL;
+}
+
+static bool isHopReady(const HopQueues::Hop& hop, TickType_t now) {
+    return !hop.frames.empty() && !isHeld(hop, now) && hasCredits(hop);
+}
+
+static void trackStall(HopQueues::Hop& hop, TickType_t now) {
+    bool stalled = !hop.frames.empty() && !hasCredits(hop);
+    if (stalled && !hop.stalled_since) {
+        hop.stalled_since = now;
+        hop.credit_stalls++;
+    } else if (!stalled && hop.stalled_since) {
+        hop.credit_stall_ticks += now - *hop.stalled_since;
+        hop.stalled_since.reset();
+    }
+}
+
+static bool isExpired(const HopQueues::Queued& queued, TickType_t now) {
+    return queued.deadline && static_cast<int32_t>(now - *queued.deadline) >= 0 && !isStarted(queued.entry);
+}
+
+/**
+ * Drops the entries of the hop whose deadline has passed, together with the queued fragments of the same frames.
+ */
+void HopQueues::dropExpired(Hop& hop, TickType_t now) {
+    while (true) {
+        auto expired = std::find_if(hop.frames.begin(), hop.frames.end(),
+                                    [&](const Queued& queued) { return isExpired(queued, now); });
+        if (expired == hop.frames.end()) return;
+
+        auto frag_id = expired->frag_id;
+        hop.frames.erase(expired);
+        expired_++;
+        // the other fragments are useless without the dropped one
+        if (frag_id) {
+            expired_ += std::erase_if(hop.frames, [&](const Queued& queued) { return queued.frag_id == frag_id; });
+        }
+    }
+}
+
+#if CONFIG_CODEL
+/**
+ * Returns true iff CoDel may drop the entry, which is IP traffic of the lower classes that has not begun to be sent.
+ * Pure ACKs are kept, since dropping them hardly shortens the queue but stalls the flow.
+ */
+static bool isDroppable(const HopQueues::Queued& queued) {
+    if (queued.priority > packets::Priority::BEST_EFFORT) return false;
+    if (auto* ip_frame = std::get_if<IpFrame>(&queued.entry)) return !ip_frame->isStarted() && !ip_frame->pureAck();
+    return queued.frag_id.has_value();
+}
+
+static std::deque<HopQueues::Queued>::iterator firstDroppable(HopQueues::Hop& hop) {
+    return std::find_if(hop.frames.begin(), hop.frames.end(), isDroppable);
+}
+
+static bool isReached(TickType_t now, TickType_t time) { return static_cast<int32_t>(now - time) >= 0; }
+
+/**
+ * Keeps track of how long the droppable traffic of the hop has been waiting longer than the target.
+ * @return true once that has been the case for a whole interval
+ */
+static bool aboveTarget(HopQueues::Hop& hop, TickType_t now) {
+    auto& codel = hop.codel;
+    auto head = firstDroppable(hop);
+    // a single frame is no standing queue
+    if (head == hop.frames.end() || hop.frames.size() <= 1 || now - head->enqueued_at < CODEL_TARGET) {
+        codel.first_above_time.reset();
+        return false;
+    }
+    if (!codel.first_above_time) {
+        codel.first_above_time = now + CODEL_INTERVAL;
+        return false;
+    }
+    return isReached(now, *codel.first_above_time);
+}
+
+/**
+ * Drops the first droppable entry of the hop, together with the queued fragments of the same frame.
+ * @return the number of dropped entries
+ */
+static size_t dropHead(HopQueues::Hop& hop) {
+    auto head = firstDroppable(hop);
+    if (head == hop.frames.end()) return 0;
+
+    auto frag_id = head->frag_id;
+    hop.frames.erase(head);
+    if (!frag_id) return 1;
+
+    // the other fragments are useless without the dropped one
+    return 1 + std::erase_if(hop.frames, [&](const HopQueues::Queued& queued) { return queued.frag_id == frag_id; });
+}
+
+static TickType_t controlLaw(TickType_t time, uint32_t count) {
+    return time + static_cast<TickType_t>(CODEL_INTERVAL / std::sqrt(static_cast<float>(count)));
+}
+
+void HopQueues::controlDelay(Hop& hop, TickType_t now) {
+    auto& codel = hop.codel;
+    bool ok_to_drop = aboveTarget(hop, now);
+
+    if (codel.dropping) {
+        if (!ok_to_drop) {
+            codel.dropping = false;
+            return;
+        }
+        // drop at an increasing rate for as long as the delay stays above the target
+        while (codel.dropping && isReached(now, codel.drop_next)) {
+            delay_dropped_ += dropHead(hop);
+            codel.count++;
+            if (aboveTarget(hop, now)) {
+                codel.drop_next = controlLaw(codel.drop_next, codel.count);
+            } else {
+                codel.dropping = false;
+            }
+        }
+    } else if (ok_to_drop) {
+        delay_dropped_ += dropHead(hop);
+        codel.dropping = true;
+        // if dropping stopped only recently, resume close to the rate that was needed then
+        auto delta = codel.count - codel.last_count;
+        codel.count = delta > 1 && now - codel.drop_next < 16 * CODEL_INTERVAL ? delta : 1;
+        codel.drop_next = controlLaw(now, codel.count);
+        codel.last_count = codel.count;
+    }
+}
+#endif
+
+std::optional<Frame> HopQueues::pop() {
+    auto now = xTaskGetTickCount();
+    for (auto& hop : hops_) {
+        // no use spending airtime on data whose destination has already given up on it
+        dropExpired(hop, now);
+#if CONFIG_CODEL
+        controlDelay(hop, now);
+#endif
+        trackStall(hop, now);
+    }
+    if (std::none_of(hops_.begin(), hops_.end(), [&](const Hop& hop) { return isHopReady(hop, now); })) {
+        return std::nullopt;
+    }
+
+    while (true) {
+        auto& hop = hops_[current_];
+        if (isHopReady(hop, now) && hop.deficit >= nextSize(hop.frames.front().entry)) {
+            return serve(hop);
+        }
+
+        // idle hops must not accumulate credit
+        if (hop.frames.empty()) hop.deficit = 0;
+
+        // next round for the next hop
+        current_ = (current_ + 1) % hops_.size();
+        auto& next = hops_[current_];
+        if (isHopReady(next, now)) next.deficit += QUANTUM;
+    }
+}
+
+Frame HopQueues::serve(Hop& hop) {
+    auto enqueued_at = hop.frames.front().enqueued_at;
+    auto priority = hop.frames.front().priority;
+    auto buffer = takeNext(hop.frames);
+    size_t num_packets = 1;
+    // every packet except control packets takes a place in the receive queue of the neighbor
+    uint32_t charged = priority == packets::Priority::CONTROL ? 0 : 1;
+
+    // pack following small packets into an aggregate as long as they fit and the deficit allows
+    if (isSmall(buffer.size()) && !hop.frames.empty() && isSmall(nextSize(hop.frames.front().entry))) {
+        packets::Aggregate aggregate;
+        packets::appendToAggregate(aggregate, buffer);
+
+        while (!hop.frames.empty()) {
+            auto size = nextSize(hop.frames.front().entry);
+            auto new_data_size = aggregate.data.size() + 1 + size;
+            if (!isSmall(size) || new_data_size > MAX_AGGREGATE_DATA_SIZE) break;
+            if (hop.deficit < HEADER_SIZE + 2 + new_data_size) break;
+
+            bool charge = hop.frames.front().priority != packets::Priority::CONTROL;
+            if (charge && hop.credits && charged >= *hop.credits) break;
+
+            packets::appendToAggregate(aggregate, takeNext(hop.frames));
+            num_packets++;
+            if (charge) charged++;
+        }
+
+        if (num_packets > 1) {
+            buffer = packets::serialize(
+                packets::Packet{esp_random(), state::getThisMac(), hop.next_hop, std::move(aggregate)});
+        }
+    }
+
+    if (hop.credits) *hop.credits -= std::min(*hop.credits, charged);
+
+    hop.deficit -= buffer.size();
+    hop.bytes_sent += buffer.size();
+    return Frame{hop.next_hop, std::move(buffer), enqueued_at, num_packets, priority};
+}
+
+bool HopQueues::empty() const {
+    return std::all_of(hops_.begin(), hops_.end(), [](const Hop& hop) { return hop.frames.empty(); });
+}
+
+bool HopQueues::isReady() const {
+    auto now = xTaskGetTickCount();
+    return std::any_of(hops_.begin(), hops_.end(), [&](const Hop& hop) { return isHopReady(hop, now); });
+}
+
+TickType_t HopQueues::nextReleaseIn() const {
+    auto now = xTaskGetTickCount();
+    TickType_t next_release = portMAX_DELAY;
+    for (const auto& hop : hops_) {
+        if (hop.frames.empty() || !isHeld(hop, now)) continue;
+        next_release = std::min(next_release, oldestEnqueuedAt(hop, now) + AGGREGATION_BUDGET - now);
+    }
+    return next_release;
+}
+
+bool HopQueues::isStalled() const {
+    return std::any_of(hops_.begin(), hops_.end(), [](const Hop& hop) { return hop.stalled_since.has_value(); });
+}
+
+void HopQueues::setCredits(const util::MacAddr& next_hop, std::optional<uint32_t> credits) {
+    getOrCreate(next_hop).credits = credits;
+}
+
+size_t HopQueues::prune(const std::function<bool(const util::MacAddr&)>& keep) {
+    size_t dropped = 0;
+    std::erase_if(hops_, [&](const Hop& hop) {
+        if (keep(hop.next_hop)) return false;
+        dropped += hop.frames.size();
+        return true;
+    });
+    if (current_ >= hops_.size()) current_ = 0;
+    return dropped;
+}
+
+void HopQueues::updateRates(TickType_t elapsed) {
+    if (elapsed == 0) return;
+    for (auto& hop : hops_) {
+        hop.bytes_per_second = hop.bytes_sent * configTICK_RATE_HZ / elapsed;
+        hop.bytes_sent = 0;
+    }
+}
+
+HopQueues::Hop& HopQueues::getOrCreate(const util::MacAddr& next_hop) {
+    auto it = std::find_if(hops_.begin(), hops_.end(), [&](const Hop& hop) { return hop.next_hop == next_hop; });
+    if (it != hops_.end()) return *it;
+    return hops_.emplace_back(next_hop);
+}
+
+}  // namespace meshnow::send
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+
+#include <deque>
+#include <functional>
+#include <optional>
+#include <span>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ip_frame.hpp"
+#include "packets.hpp"
+#include "util/mac.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::send {
+
+/**
+ * A serialized frame ready to be handed to the driver.
+ */
+struct Frame {
+    util::MacAddr next_hop;
+    util::Buffer buffer;
+    // when the oldest packet in this frame was enqueued
+    TickType_t enqueued_at;
+    // number of packets in this frame, more than one if aggregated
+    size_t packets;
+    // class of the first packet in this frame
+    packets::Priority priority;
+};
+
+/**
+ * Per-next-hop frame queues, served by deficit round-robin weighted by bytes.
+ * This gives every neighbor (and thereby every subtree) a fair share of the airtime, regardless of how much traffic
+ * is queued for the others.
+ *
+ * Within the queue of a hop, packets are served strictly by their priority class and in order within a class. If the
+ * queue is full, a packet of a higher class replaces the last packet of the lowest class.
+ *
+ * IP traffic whose deadline passes while it waits is dropped when the hop is served, unless it has begun to be sent.
+ *
+ * To keep TCP from building a standing queue, the IP traffic of the lower classes is subject to CoDel per hop: once it
+ * has waited longer than a target delay for a whole interval, it is dropped from the head at an increasing rate.
+ *
+ * Of control packets that only carry the latest state, like status beacons, at most one per destination is queued.
+ * A newer one takes the place of the queued one, so the latest state goes out as early as possible.
+ *
+ * Neighbors advertise how many frames they can take. A hop without credits only gets control packets, which consume no
+ * credits, so the advertisements themselves are never held back.
+ *
+ * Small packets for the same next hop are aggregated into a single frame. To give them the chance to be aggregated, a
+ * hop holding only a few small packets is not served until its oldest packet has waited for the aggregation budget.
+ */
+class HopQueues {
+   public:
+    // either an already serialized packet or an IP frame that is cut into fragments when dequeued
+    using Entry = std::variant<util::Buffer, IpFrame>;
+
+    // identifies control packets of which only the newest one per destination is worth sending
+    struct Coalescable {
+        // packets of the same kind supersede each other
+        uint8_t kind;
+        util::MacAddr to;
+        // order in which the packets were first enqueued
+        uint32_t seq;
+    };
+
+    struct Queued {
+        Entry entry;
+        TickType_t enqueued_at;
+        packets::Priority priority;
+        // set for a forwarded fragment to the frame it belongs to
+        std::optional<uint32_t> frag_id;
+        std::optional<Coalescable> coalescable;
+        // when the entry is no longer worth sending, unset if it never expires
+        std::optional<TickType_t> deadline;
+    };
+
+    // CoDel state of a hop, see RFC 8289
+    struct Codel {
+        // when the delay will have been above the target for a whole interval, unset while it is below
+        std::optional<TickType_t> first_above_time;
+        TickType_t drop_next{0};
+        uint32_t count{0};
+        uint32_t last_count{0};
+        bool dropping{false};
+    };
+
+    struct Hop {
+        explicit Hop(const util::MacAddr& next_hop) : next_hop{next_hop} {}
+
+        Hop(const Hop&) = delete;
+        Hop& operator=(const Hop&) = delete;
+        Hop(Hop&&) = default;
+        Hop& operator=(Hop&&) = default;
+
+        util::MacAddr next_hop;
+        std::deque<Queued> frames;
+        size_t deficit{0};
+        // bytes dequeued since the last rate update
+        uint32_t bytes_sent{0};
+        uint32_t bytes_per_second{0};
+        Codel codel;
+        // frames the neighbor can still take, unlimited until it advertises credits
+        std::optional<uint32_t> credits;
+        // set while frames are waiting for credits
+        std::optional<TickType_t> stalled_since;
+        uint32_t credit_stalls{0};
+        TickType_t credit_stall_ticks{0};
+    };
+
+    /**
+     * Enqueues an entry for the given next hop behind all entries of the same or a higher class.
+     * A coalescable control packet instead takes the place of a queued one of the same kind and destination.
+     * @param frag_id the frame a forwarded fragment belongs to, so that its siblings can be dropped together
+     * @param coalescable set for control packets that supersede older ones of their kind
+     * @param deadline when the entry is dropped if it has not begun to be sent by then
+     * @return false if the queue of that hop is full of entries of the same or a higher class
+     */
+    bool push(const util::MacAddr& next_hop, Entry entry, packets::Priority priority,
+              std::optional<uint32_t> frag_id = std::nullopt, std::optional<Coalescable> coalescable = std::nullopt,
+              std::optional<TickType_t> deadline = std::nullopt);
+
+    /**
+     * Replaces a queued pure ACK of the same flow with the given newer one, keeping its place in the queue.
+     * Duplicate ACKs are never replaced, since TCP relies on them for fast retransmit.
+     * Neither are ACKs carrying a new header reference, nor those compressed against another generation of it.
+     * @return true if an ACK was replaced, the given frame is moved from only then
+     */
+    bool supersedeAck(const util::MacAddr& next_hop, IpFrame& frame);
+
+    /**
+     * Sets how many more frames the next hop may be sent, as advertised by it.
+     * @param credits the number of frames, or nullopt if the next hop takes any number
+     */
+    void setCredits(const util::MacAddr& next_hop, std::optional<uint32_t> credits);
+
+    /**
+     * Dequeues the next frame to be sent, if any hop is ready to be served.
+     */
+    std::optional<Frame> pop();
+
+    bool empty() const;
+
+    /**
+     * Returns true iff there is a hop that is ready to be served, i.e. not holding back packets for aggregation.
+     */
+    bool isReady() const;
+
+    /**
+     * Returns the time until the next hop stops holding back packets, or portMAX_DELAY if none does.
+     */
+    TickType_t nextReleaseIn() const;
+
+    /**
+     * Returns true iff there is a hop whose frames are waiting for credits.
+     */
+    bool isStalled() const;
+
+    /**
+     * Removes all hops for which keep returns false, together with their queued frames.
+     * @return the number of dropped frames
+     */
+    size_t prune(const std::function<bool(const util::MacAddr&)>& keep);
+
+    /**
+     * Calculates the byte rate of every hop over the elapsed time since the last call.
+     */
+    void updateRates(TickType_t elapsed);
+
+    std::span<const Hop> hops() const { return {hops_.data(), hops_.size()}; }
+
+    /**
+     * Returns the number of entries replaced by entries of a higher class since the last call.
+     */
+    size_t takeEvicted() { return std::exchange(evicted_, 0); }
+
+    /**
+     * Returns the number of entries dropped to keep the queue delay low since the last call.
+     */
+    size_t takeDelayDropped() { return std::exchange(delay_dropped_, 0); }
+
+    /**
+     * Returns the number of entries dropped because their deadline had passed since the last call.
+     */
+    size_t takeExpired() { return std::exchange(expired_, 0); }
+
+    /**
+     * Returns the number of control packets that superseded or were superseded by a queued one since the last call.
+     */
+    size_t takeCoalesced() { return std::exchange(coalesced_, 0); }
+
+   private:
+    Hop& getOrCreate(const util::MacAddr& next_hop);
+
+    Frame serve(Hop& hop);
+
+    bool coalesce(Hop& hop, Entry& entry, const Coalescable& coalescable);
+
+    void dropExpired(Hop& hop, TickType_t now);
+
+    void controlDelay(Hop& hop, TickType_t now);
+
+    std::vector<Hop> hops_;
+    size_t current_{0};
+    size_t evicted_{0};
+    size_t delay_dropped_{0};
+    size_t expired_{0};
+    size_t coalesced_{0};
+};
+
+}  // namespace meshnow::send
@@ -0,0 +1,86 @@
+#include "ip_frame.hpp"
+
+#include <esp_random.h>
+
+#include <algorithm>
+
+#include "constants.hpp"
+#include "packets.hpp"
+
+namespace meshnow::send {
+
+/**
+ * Returns a mask of the fragments to cut: all of them, or only those covering a missing regular fragment.
+ */
+static uint8_t pendingFragments(uint16_t total_size, bool large, const std::optional<Resend>& resend) {
+    auto num_fragments = (total_size + packets::fragmentUnit(large) - 1) / packets::fragmentUnit(large);
+    if (!resend) return (1 << num_fragments) - 1;
+
+    uint8_t pending = 0;
+    for (int i = 0; i < PARITY_FRAG_NUM; ++i) {
+        if (resend->missing & (1 << i)) pending |= 1 << (large ? i / LARGE_FRAG_UNITS : i);
+    }
+    return pending & ((1 << num_fragments) - 1);
+}
+
+IpFrame::IpFrame(util::PbufPtr data, const util::MacAddr& from, const util::MacAddr& to, bool large, bool parity,
+                 const FrameInfo& info, std::optional<packets::ShortAddrs> short_addrs)
+    : frame_(std::move(data)),
+      data_(static_cast<const uint8_t*>(frame_->payload)),
+      size_(frame_->tot_len),
+      from_(from),
+      to_(to),
+      // a resend has to end up in the same reassembly as the original fragments
+      frag_id_(info.resend ? info.resend->frag_id : packets::withPriority(esp_random(), info.priority)),
+      large_(large),
+      // for less than three fragments, the parity would add half of the frame or more
+      // large fragments are never more than two, so frames cut into them go without parity
+      parity_(parity && !large && !info.resend && size_ > 2 * MAX_FRAG_PAYLOAD_SIZE),
+      info_(info),
+      short_addrs_(short_addrs),
+      pending_(pendingFragments(size_, large, info.resend)) {
+    assert(frame_->len == frame_->tot_len && "Chained pbufs are not supported");
+}
+
+static size_t chunkSize(uint16_t size, uint16_t offset, bool large) {
+    return std::min<size_t>(size - offset, packets::fragmentUnit(large));
+}
+
+size_t IpFrame::nextSize() const {
+    // the parity fragment is as large as the first fragment
+    auto frag_num = pending_ == 0 ? 0 : __builtin_ctz(pending_);
+    return packets::headerSize(short_addrs_) + FRAG_HEADER_SIZE +
+           chunkSize(size_, frag_num * packets::fragmentUnit(large_), large_);
+}
+
+util::Buffer IpFrame::cutNext() {
+    started_ = true;
+    if (pending_ == 0) return cutParity();
+
+    uint8_t frag_num = __builtin_ctz(pending_);
+    uint16_t offset = frag_num * packets::fragmentUnit(large_);
+    auto size = chunkSize(size_, offset, large_);
+
+    auto buffer = packets::serializeFragment(esp_random(), from_, to_, frag_id_, frag_num, size_, large_,
+                                             info_.compressed, data_ + offset, size, short_addrs_);
+
+    pending_ &= ~(1 << frag_num);
+
+    return buffer;
+}
+
+util::Buffer IpFrame::cutParity() {
+    auto unit = MAX_FRAG_PAYLOAD_SIZE;
+
+    // XOR of all fragments, the last one padded with zeros
+    util::Buffer parity(chunkSize(size_, 0, false), 0);
+    for (size_t i = 0; i < size_; ++i) {
+        parity[i % unit] ^= data_[i];
+    }
+
+    parity_ = false;
+    return packets::serializeFragment(esp_random(), from_, to_, frag_id_, PARITY_FRAG_NUM, size_, false,
+                                      info_.compressed, parity.data(), parity.size(), short_addrs_);
+}
+
+}  // namespace meshnow::send
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+#include "packets.hpp"
+#include "util/mac.hpp"
+#include "util/pbuf.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::send {
+
+/**
+ * A pure TCP ACK, i.e. one without data, SYN, FIN or RST.
+ */
+struct PureAck {
+    // IP addresses and ports of the flow
+    std::array<uint8_t, 12> flow;
+    uint32_t ack;
+};
+
+/**
+ * Fragments of an already sent IP frame that the destination asked for again.
+ */
+struct Resend {
+    uint32_t frag_id;
+    // each bit corresponds to a missing regular fragment
+    uint8_t missing;
+};
+
+/**
+ * What is known about an outgoing IP frame.
+ */
+struct FrameInfo {
+    // the frame has compressed headers
+    bool compressed{false};
+    // set for compressed frames that carry a new header reference, which the following frames of the flow need
+    bool carries_reference{false};
+    // generation of the header reference of a compressed frame
+    uint8_t generation{0};
+    // set if the frame is a pure TCP ACK, which is superseded by a newer ACK of the same flow
+    std::optional<PureAck> pure_ack;
+    // set if only the missing fragments of an earlier transmission are sent
+    std::optional<Resend> resend;
+    // class the frame is scheduled in at every hop
+    packets::Priority priority{packets::Priority::BEST_EFFORT};
+};
+
+/**
+ * An outgoing IP frame of the network interface.
+ * Instead of fragmenting it up front, the DataFragments are cut one by one when they are about to be sent.
+ * Optionally, a parity fragment follows the data fragments, from which the destination can restore any single lost one.
+ */
+class IpFrame {
+   public:
+    /**
+     * @param data single (unchained) pbuf holding the frame
+     * @param from the address written as the from field of every fragment
+     * @param to the address written as the to field of every fragment
+     * @param large whether to cut large fragments, only if the next hop supports large frames
+     * @param parity whether to add a parity fragment, only if the frame spans at least three regular fragments
+     * @param info what the network interface knows about the frame
+     * @param short_addrs if set, every fragment gets a compact header with these short IDs
+     */
+    IpFrame(util::PbufPtr data, const util::MacAddr& from, const util::MacAddr& to, bool large, bool parity,
+            const FrameInfo& info, std::optional<packets::ShortAddrs> short_addrs);
+
+    /**
+     * Returns true once all fragments have been cut.
+     */
+    bool isDone() const { return pending_ == 0 && !parity_; }
+
+    /**
+     * Returns true once the first fragment has been cut.
+     */
+    bool isStarted() const { return started_; }
+
+    uint32_t fragId() const { return frag_id_; }
+
+    /**
+     * Returns true if a parity fragment is still to be cut.
+     */
+    bool hasParity() const { return parity_; }
+
+    const std::optional<PureAck>& pureAck() const { return info_.pure_ack; }
+
+    const FrameInfo& info() const { return info_; }
+
+    /**
+     * Returns the serialized size of the next fragment.
+     */
+    size_t nextSize() const;
+
+    /**
+     * Serializes the next fragment.
+     */
+    util::Buffer cutNext();
+
+   private:
+    util::Buffer cutParity();
+
+    // keeps the frame alive, its contents are only read through data_ and size_ captured on construction
+    util::PbufPtr frame_;
+    const uint8_t* data_;
+    uint16_t size_;
+    util::MacAddr from_;
+    util::MacAddr to_;
+    uint32_t frag_id_;
+    bool large_;
+    // parity fragment still to be cut
+    bool parity_;
+    FrameInfo info_;
+    std::optional<packets::ShortAddrs> short_addrs_;
+    // each bit corresponds to a fragment that is still to be cut
+    uint8_t pending_;
+    bool started_{false};
+};
+
+}  // namespace meshnow::send
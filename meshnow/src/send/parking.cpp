@@ -0,0 +1,112 @@
+#include "parking.hpp"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "queue.hpp"
+#include "util/mutex.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::send {
+
+static constexpr auto TAG = CREATE_TAG("Parking");
+
+// how many frames are held back at most, the oldest one is dropped first
+static constexpr auto MAX_FRAMES{8};
+
+// nodes that did not come back after this will have to reconnect their netif anyway
+static constexpr auto PARK_TIME = pdMS_TO_TICKS(CONFIG_HANDOVER_GRACE_PERIOD);
+
+namespace {
+
+struct ParkedFrame {
+    util::MacAddr to;
+    util::PbufPtr frame;
+    SendBehavior behavior;
+    FrameInfo info;
+    TickType_t parked_at;
+};
+
+// frames are parked by the send worker and released from the packet handler
+util::Mutex mutex;
+
+std::deque<ParkedFrame> frames;
+
+struct {
+    std::atomic<uint32_t> parked;
+    std::atomic<uint32_t> delivered;
+} stats;
+
+void prune(TickType_t now) {
+    while (!frames.empty() && now - frames.front().parked_at >= PARK_TIME) {
+        frames.pop_front();
+    }
+}
+
+}  // namespace
+
+void parkFrame(const util::MacAddr& to, const pbuf* frame, const SendBehavior& behavior, const FrameInfo& info) {
+    if (PARK_TIME == 0) return;
+
+    util::PbufPtr copy{pbuf_alloc(PBUF_RAW, frame->tot_len, PBUF_RAM)};
+    if (!copy) return;
+    pbuf_copy_partial(frame, copy->payload, frame->tot_len, 0);
+
+    auto now = xTaskGetTickCount();
+
+    std::lock_guard lock{mutex};
+    prune(now);
+    if (frames.size() == MAX_FRAMES) frames.pop_front();
+    frames.push_back(ParkedFrame{to, std::move(copy), behavior, info, now});
+    stats.parked++;
+}
+
+void unparkFrames(const util::MacAddr& to) {
+    std::vector<ParkedFrame> released;
+    {
+        std::lock_guard lock{mutex};
+        prune(xTaskGetTickCount());
+        for (auto it = frames.begin(); it != frames.end();) {
+            if (it->to == to) {
+                released.push_back(std::move(*it));
+                it = frames.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    if (released.empty()) return;
+
+    // may block on a full send queue, so not while holding the mutex
+    ESP_LOGD(TAG, "Sending %d held back frames to " MACSTR, released.size(), MAC2STR(to));
+    for (auto& parked : released) {
+        enqueueFrame(std::move(parked.frame), std::move(parked.behavior), parked.info);
+        stats.delivered++;
+    }
+}
+
+void pruneParked() {
+    std::lock_guard lock{mutex};
+    prune(xTaskGetTickCount());
+}
+
+void forgetParked() {
+    std::lock_guard lock{mutex};
+    frames.clear();
+}
+
+ParkingStats getParkingStats() {
+    return ParkingStats{
+        .parked = stats.parked,
+        .delivered = stats.delivered,
+    };
+}
+
+}  // namespace meshnow::send
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+#include "def.hpp"
+#include "ip_frame.hpp"
+#include "util/mac.hpp"
+#include "util/pbuf.hpp"
+
+namespace meshnow::send {
+
+/**
+ * Root only: IP frames for a node that is currently not reachable are held back for a while, since the node is most
+ * likely changing its parent and keeps its IP address. They are sent as soon as the node is announced again.
+ *
+ * Copies of the frames are held, since lwIP does not retransmit a segment while someone else holds its pbuf.
+ */
+
+struct ParkingStats {
+    // frames held back for an unreachable node
+    uint32_t parked;
+    // held back frames that were sent after the node came back
+    uint32_t delivered;
+};
+
+/**
+ * Holds back a frame for the given node.
+ */
+void parkFrame(const util::MacAddr& to, const pbuf* frame, const SendBehavior& behavior, const FrameInfo& info);
+
+/**
+ * Sends the frames held back for the given node, which is reachable again.
+ */
+void unparkFrames(const util::MacAddr& to);
+
+/**
+ * Drops all frames that have been held back for too long.
+ */
+void pruneParked();
+
+/**
+ * Drops all frames.
+ */
+void forgetParked();
+
+ParkingStats getParkingStats();
+
+}  // namespace meshnow::send
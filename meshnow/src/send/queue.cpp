@@ -1,30 +1,96 @@
 #include "queue.hpp"
 
+#include <esp_log.h>
 #include <esp_random.h>
+#include <sdkconfig.h>
 
+#include <atomic>
 #include <utility>
 
+#include "lock.hpp"
 #include "util/queue.hpp"
+#include "util/util.hpp"
 
 static constexpr auto QUEUE_SIZE{32};
-// TODO QUEUE_SIZE has to be higher so not to get deadlocks! FIND A REAL SOLUTION!
 
 namespace meshnow::send {
 
+static constexpr auto TAG = CREATE_TAG("SendQueue");
+
 static util::Queue<Item> queue;
 
+static std::atomic<uint32_t> dropped_items{0};
+
+// IP traffic is of no use once the destination has discarded the other fragments of its frame
+static constexpr auto DATA_DEADLINE = pdMS_TO_TICKS(CONFIG_FRAGMENT_TIMEOUT);
+
+// interactive traffic is retried by its application long before that
+static constexpr auto INTERACTIVE_DEADLINE = DATA_DEADLINE / 3;
+
+packets::Priority priorityOf(const Item& item) {
+    if (item.frame) return item.frame_info.priority;
+    // forwarded fragments keep the class their source gave them
+    if (auto* fragment = std::get_if<packets::DataFragment>(&item.payload)) {
+        return packets::fragmentPriority(fragment->frag_id);
+    }
+    if (std::holds_alternative<packets::CustomData>(item.payload)) return packets::Priority::BEST_EFFORT;
+    // keep-alives and routing updates must never be starved by IP traffic
+    return packets::Priority::CONTROL;
+}
+
+/**
+ * Returns the deadline of a new item, control packets and custom data are never dropped for being late.
+ */
+static std::optional<TickType_t> deadlineOf(const Item& item) {
+    bool ip = item.frame || std::holds_alternative<packets::DataFragment>(item.payload);
+    if (!ip) return std::nullopt;
+
+    auto now = xTaskGetTickCount();
+    switch (priorityOf(item)) {
+        case packets::Priority::CONTROL:
+            return std::nullopt;
+        case packets::Priority::INTERACTIVE:
+            return now + INTERACTIVE_DEADLINE;
+        default:
+            return now + DATA_DEADLINE;
+    }
+}
+
+bool isExpired(const Item& item, TickType_t now) {
+    return item.deadline && static_cast<int32_t>(now - *item.deadline) >= 0;
+}
+
+static std::atomic<uint32_t> next_seq{0};
+
+static void push(Item item) {
+    item.deadline = deadlineOf(item);
+    item.seq = next_seq++;
+    // the send worker takes the lock before it empties the queue, so whoever holds it must never wait for room
+    auto timeout = Lock::isHeld() ? 0 : portMAX_DELAY;
+    if (!queue.push_back(std::move(item), timeout)) {
+        ESP_LOGD(TAG, "Send queue full, dropping item");
+        dropped_items++;
+    }
+}
+
 esp_err_t init() { return queue.init(QUEUE_SIZE); }
 
 void deinit() { queue = util::Queue<Item>{}; }
 
 void enqueuePayload(const packets::Payload& payload, SendBehavior behavior, uint32_t id) {
-    queue.push_back(Item{payload, std::move(behavior), id}, portMAX_DELAY);
+    push(Item{payload, std::move(behavior), id, nullptr, {}, std::nullopt, 0});
 }
 
 void enqueuePayload(const packets::Payload& payload, SendBehavior behavior) {
     enqueuePayload(payload, std::move(behavior), esp_random());
 }
 
+void enqueueFrame(util::PbufPtr frame, SendBehavior behavior, const FrameInfo& info) {
+    push(Item{packets::Payload{}, std::move(behavior), 0, std::move(frame), info, std::nullopt, 0});
+}
+
 std::optional<Item> popItem(TickType_t timeout) { return queue.pop(timeout); }
 
+uint32_t droppedItems() { return dropped_items; }
+
 }  // namespace meshnow::send
\ No newline at end of file
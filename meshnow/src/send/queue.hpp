@@ -5,10 +5,14 @@
 
 #include <memory>
 #include <optional>
+#include <utility>
+#include <vector>
 
 #include "def.hpp"
+#include "ip_frame.hpp"
 #include "packets.hpp"
 #include "util/mac.hpp"
+#include "util/pbuf.hpp"
 #include "util/util.hpp"
 
 namespace meshnow::send {
@@ -17,8 +21,28 @@ struct Item {
     packets::Payload payload;
     SendBehavior behavior;
     uint32_t id;
+    // IP frame that is fragmented only when sent, payload and id are unused if set
+    util::PbufPtr frame;
+    // what the network interface knows about the IP frame
+    FrameInfo frame_info;
+    // after this, the item is of no use to its destination anymore and is dropped instead of sent
+    std::optional<TickType_t> deadline;
+    // order in which items were first enqueued, to tell newer control packets from older ones
+    uint32_t seq;
+    // number of regular parts of a split large fragment already queued per next hop, a retry only queues the rest
+    std::vector<std::pair<util::MacAddr, uint8_t>> split_queued{};
 };
 
+/**
+ * Returns the class the item is scheduled in.
+ */
+packets::Priority priorityOf(const Item& item);
+
+/**
+ * Returns true iff the deadline of the item has passed.
+ */
+bool isExpired(const Item& item, TickType_t now);
+
 /**
  * Initializes the send queue.
  */
@@ -39,6 +63,19 @@ void enqueuePayload(const packets::Payload& payload, SendBehavior behavior, uint
 
 void enqueuePayload(const packets::Payload& payload, SendBehavior behavior);
 
+/**
+ * Enqueues an IP frame to be sent as DataFragments.
+ * @param frame The frame to send, must be a single (unchained) pbuf
+ * @param behavior The behavior to use for sending
+ * @param info What the network interface knows about the frame
+ */
+void enqueueFrame(util::PbufPtr frame, SendBehavior behavior, const FrameInfo& info);
+
 std::optional<Item> popItem(TickType_t timeout);
 
+/**
+ * Returns the number of items that were dropped because the send queue was full while the lock was held.
+ */
+uint32_t droppedItems();
+
 }  // namespace meshnow::send
\ No newline at end of file
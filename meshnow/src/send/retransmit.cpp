@@ -0,0 +1,97 @@
+#include "retransmit.hpp"
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <sdkconfig.h>
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <mutex>
+
+#include "queue.hpp"
+#include "state.hpp"
+#include "util/mutex.hpp"
+#include "util/util.hpp"
+
+namespace meshnow::send {
+
+static constexpr auto TAG = CREATE_TAG("Retransmit");
+
+// how many frames are kept at most
+static constexpr auto MAX_FRAMES{CONFIG_FRAGMENT_NACK_KEEP_FRAMES};
+
+// how long a frame is kept, below the TCP retransmission timeout
+static constexpr auto KEEP_TIME = pdMS_TO_TICKS(CONFIG_FRAGMENT_NACK_KEEP_TIME);
+
+namespace {
+
+struct SentFrame {
+    uint32_t frag_id;
+    util::PbufPtr frame;
+    util::MacAddr to;
+    FrameInfo info;
+    TickType_t sent_at;
+};
+
+// frames are remembered by the send worker and resent from the packet handler
+util::Mutex mutex;
+
+std::deque<SentFrame> frames;
+
+std::atomic<uint32_t> resent_frames;
+
+void prune(TickType_t now) {
+    while (!frames.empty() && now - frames.front().sent_at >= KEEP_TIME) {
+        frames.pop_front();
+    }
+}
+
+}  // namespace
+
+void rememberFrame(uint32_t frag_id, pbuf* frame, const util::MacAddr& to, const FrameInfo& info) {
+    auto now = xTaskGetTickCount();
+
+    std::lock_guard lock{mutex};
+    prune(now);
+    if (std::any_of(frames.begin(), frames.end(), [&](const SentFrame& sent) { return sent.frame.get() == frame; })) {
+        return;
+    }
+    if (frames.size() == MAX_FRAMES) frames.pop_front();
+    frames.push_back(SentFrame{frag_id, util::refPbuf(frame), to, info, now});
+}
+
+bool resendFragments(uint32_t frag_id, uint8_t missing) {
+    std::unique_lock lock{mutex};
+    prune(xTaskGetTickCount());
+
+    auto it = std::find_if(frames.begin(), frames.end(), [&](const SentFrame& sent) { return sent.frag_id == frag_id; });
+    if (it == frames.end()) return false;
+
+    auto frame = util::refPbuf(it->frame.get());
+    auto to = it->to;
+    auto info = it->info;
+    info.resend = Resend{frag_id, missing};
+    lock.unlock();
+
+    // may block on a full send queue, so not while holding the mutex
+    ESP_LOGD(TAG, "Resending fragments 0x%02x of frame %lu", missing, frag_id);
+    enqueueFrame(std::move(frame), FullyResolve(state::getThisMac(), to, state::getThisMac()), info);
+    resent_frames++;
+    return true;
+}
+
+void pruneFrames() {
+    std::lock_guard lock{mutex};
+    prune(xTaskGetTickCount());
+}
+
+void forgetFrames() {
+    std::lock_guard lock{mutex};
+    frames.clear();
+}
+
+uint32_t resentFrames() { return resent_frames; }
+
+}  // namespace meshnow::send
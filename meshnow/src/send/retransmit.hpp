@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "ip_frame.hpp"
+#include "util/mac.hpp"
+#include "util/pbuf.hpp"
+
+namespace meshnow::send {
+
+/**
+ * Recently sent IP frames of this node are kept for a short time, so that fragments the destination reports as missing
+ * can be sent again without waiting for TCP to retransmit the whole frame.
+ *
+ * The frames are only kept for less than the TCP retransmission timeout, since lwIP does not retransmit a segment while
+ * someone else still holds a reference to its pbuf.
+ */
+
+/**
+ * Remembers a sent frame spanning several fragments.
+ * A frame that is sent again while still kept, e.g. to another next hop or after it was held back, keeps the fragment
+ * ID of its first transmission.
+ */
+void rememberFrame(uint32_t frag_id, pbuf* frame, const util::MacAddr& to, const FrameInfo& info);
+
+/**
+ * Enqueues the missing fragments of a remembered frame again.
+ * @return false if the frame is not remembered anymore
+ */
+bool resendFragments(uint32_t frag_id, uint8_t missing);
+
+/**
+ * Forgets all frames that have been kept for too long.
+ */
+void pruneFrames();
+
+/**
+ * Forgets all frames.
+ */
+void forgetFrames();
+
+/**
+ * Returns how often missing fragments were resent.
+ */
+uint32_t resentFrames();
+
+}  // namespace meshnow::send
@@ -2,15 +2,28 @@
 
 #include <esp_log.h>
 #include <esp_random.h>
-#include <esp_wifi.h>
+#include <sdkconfig.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <deque>
 #include <espnow_multi.hpp>
 #include <utility>
+#include <vector>
 
+#include "constants.hpp"
 #include "def.hpp"
+#include "hop_queues.hpp"
 #include "layout.hpp"
 #include "lock.hpp"
+#include "parking.hpp"
 #include "queue.hpp"
+#include "retransmit.hpp"
+#include "short_id.hpp"
+#include "state.hpp"
+#include "util/queue.hpp"
 #include "util/util.hpp"
 #include "util/waitbits.hpp"
 
@@ -19,63 +32,653 @@ namespace meshnow::send {
 static constexpr auto TAG = CREATE_TAG("SendWorker");
 static constexpr auto MIN_TIMEOUT = pdMS_TO_TICKS(500);
 
+// maximum number of frames handed to the driver whose send callback is still outstanding
+static constexpr auto SEND_WINDOW = CONFIG_SEND_WINDOW;
+
+// how often a unicast frame is retransmitted after the driver reported a failed delivery
+static constexpr auto SEND_MAX_RETRIES = CONFIG_SEND_MAX_RETRIES;
+
+// how long to wait for new items while frames are still in flight, so that their callbacks are processed timely
+static constexpr auto IN_FLIGHT_POLL_TIMEOUT = pdMS_TO_TICKS(10);
+
+// after this time without a send callback, a frame is assumed to be lost inside the driver
+static constexpr auto COMPLETION_TIMEOUT = pdMS_TO_TICKS(100);
+
+// how many items to resolve at most per cycle
+static constexpr auto MAX_BATCH_SIZE{16};
+
+// items whose next hop had no room are kept by the worker, new items are only taken while there are fewer than this
+static constexpr size_t MAX_DEFERRED{2 * MAX_BATCH_SIZE};
+
+// interval over which the achieved frame rate is measured
+static constexpr auto RATE_INTERVAL = pdMS_TO_TICKS(1000);
+
+// number of recent delivery attempts the loss estimate of a link averages over
+static constexpr uint32_t LOSS_WINDOW{32};
+
+// queue delays are counted in power-of-two buckets of milliseconds, the last one is open-ended
+static constexpr size_t DELAY_BUCKETS{12};
+
+static struct {
+    std::atomic<uint32_t> frames_sent;
+    std::atomic<uint32_t> frames_dropped;
+    std::atomic<uint32_t> frames_failed;
+    std::atomic<uint32_t> completions_lost;
+    std::atomic<uint32_t> frames_per_second;
+    std::atomic<uint32_t> aggregate_frames;
+    std::atomic<uint32_t> aggregated_packets;
+    std::atomic<uint32_t> aggregation_delay_ticks;
+    std::atomic<uint32_t> compact_frames;
+    std::atomic<uint32_t> acks_superseded;
+    std::atomic<uint32_t> parity_fragments;
+    std::atomic<uint32_t> frames_evicted;
+    std::atomic<uint32_t> frames_delay_dropped;
+    std::atomic<uint32_t> frames_expired;
+    std::atomic<uint32_t> frames_neighbor_gone;
+    std::atomic<uint32_t> control_coalesced;
+    // time frames waited in the hop queues, per priority class
+    std::array<std::array<std::atomic<uint32_t>, DELAY_BUCKETS>, packets::NUM_PRIORITIES> queue_delays;
+} stats;
+
+struct Completion {
+    util::MacAddr peer;
+    esp_now_send_status_t status;
+};
+
 class Sender : public espnow_multi::EspnowSender {
    public:
+    esp_err_t init() { return completions_.init(SEND_WINDOW * 2); }
+
     void sendCallback(const uint8_t* peer_addr, esp_now_send_status_t status) override {
-        // NOP
+        // called from the Wi-Fi task, so only hand the result over to the worker
+        // if the queue is full, the frame is reclaimed via COMPLETION_TIMEOUT
+        completions_.push_back(Completion{util::MacAddr{peer_addr}, status}, 0);
     }
+
+    std::optional<Completion> popCompletion(TickType_t timeout) { return completions_.pop(timeout); }
+
+   private:
+    util::Queue<Completion> completions_;
 };
 
+static esp_err_t transmit(const std::shared_ptr<Sender>& sender, const util::MacAddr& next_hop,
+                          const util::Buffer& buffer) {
+    return espnow_multi::EspnowMulti::getInstance()->send(sender, next_hop.addr.data(), buffer.data(), buffer.size());
+}
+
+/**
+ * Keeps track of the frames that were handed to the driver but whose send callback has not arrived yet.
+ * Unicast frames the driver failed to deliver are retransmitted to the same hop up to SEND_MAX_RETRIES times.
+ */
+class InFlight {
+   public:
+    explicit InFlight(std::shared_ptr<Sender> sender) : sender_(std::move(sender)) {}
+
+    bool empty() const { return frames_.empty(); }
+
+    bool hasSlot() const { return frames_.size() < SEND_WINDOW; }
+
+    void add(const util::MacAddr& next_hop, util::Buffer buffer) {
+        auto& update = linkUpdate(next_hop);
+        update.tx_frames++;
+        update.tx_bytes += buffer.size();
+        frames_.push_back(Frame{next_hop, xTaskGetTickCount(), std::move(buffer), 0});
+    }
+
+    /**
+     * Processes all available send callbacks, waiting at most timeout for the first one.
+     */
+    void processCompletions(TickType_t timeout) {
+        while (auto completion = sender_->popCompletion(timeout)) {
+            complete(*completion);
+            timeout = 0;
+        }
+    }
+
+    /**
+     * Blocks until another frame may be handed to the driver.
+     */
+    void waitForSlot() {
+        processCompletions(0);
+        while (!hasSlot()) {
+            if (auto completion = sender_->popCompletion(COMPLETION_TIMEOUT)) {
+                complete(*completion);
+            } else {
+                reclaimOldest();
+            }
+        }
+    }
+
+    bool hasLinkUpdates() const { return !link_updates_.empty(); }
+
+    /**
+     * Adds the collected link counters to the respective neighbors and refreshes their queue statistics.
+     * Hands the credits the neighbors advertised since to the hop queues. Must be called with the lock held.
+     */
+    void flushLinkUpdates(HopQueues& hop_queues) {
+        auto& layout = layout::Layout::get();
+        for (auto& [mac, update] : link_updates_) {
+            if (!layout.hasNeighbor(mac)) continue;
+            auto& link_stats = layout.getNeighbor(mac).link_stats;
+            link_stats.tx_frames += update.tx_frames;
+            link_stats.tx_bytes += update.tx_bytes;
+            link_stats.tx_retries += update.tx_retries;
+            link_stats.tx_lost += update.tx_lost;
+            updateLoss(link_stats, update);
+        }
+        link_updates_.clear();
+
+        for (const auto& hop : hop_queues.hops()) {
+            if (!layout.hasNeighbor(hop.next_hop)) continue;
+            auto& neighbor = layout.getNeighbor(hop.next_hop);
+            auto& link_stats = neighbor.link_stats;
+            link_stats.tx_bytes_per_second = hop.bytes_per_second;
+            link_stats.queue_depth = hop.frames.size();
+            link_stats.credit_stalls = hop.credit_stalls;
+            link_stats.credit_stall_ms = pdTICKS_TO_MS(hop.credit_stall_ticks);
+
+            if (auto credits = std::exchange(neighbor.credits, std::nullopt)) {
+                hop_queues.setCredits(hop.next_hop, creditsLeft(hop.next_hop, *credits));
+            }
+        }
+    }
+
+    /**
+     * Returns the number of frames that the next hop can still take according to the credits it advertised.
+     * Frames whose send callback is still outstanding may not have been counted by it yet.
+     */
+    std::optional<uint32_t> creditsLeft(const util::MacAddr& next_hop, uint8_t credits) const {
+        if (credits == packets::UNLIMITED_CREDITS) return std::nullopt;
+        auto in_flight = std::count_if(frames_.begin(), frames_.end(),
+                                       [&](const Frame& frame) { return frame.next_hop == next_hop; });
+        return credits - std::min<uint32_t>(credits, in_flight);
+    }
+
+   private:
+    /**
+     * Moves the loss estimate of the link towards the share of failed delivery attempts in the update.
+     */
+    static void updateLoss(layout::LinkStats& link_stats, const layout::LinkStats& update) {
+        uint32_t attempts = update.tx_frames + update.tx_retries;
+        if (attempts == 0) return;
+
+        uint32_t failures = std::min(update.tx_retries + update.tx_lost, attempts);
+        uint32_t sample = failures * 1000 / attempts;
+        uint32_t weight = std::min(attempts, LOSS_WINDOW);
+        link_stats.loss_permille = (link_stats.loss_permille * (LOSS_WINDOW - weight) + sample * weight) / LOSS_WINDOW;
+    }
+
+    struct Frame {
+        util::MacAddr next_hop;
+        TickType_t sent_at;
+        util::Buffer buffer;
+        uint8_t retries;
+    };
+
+    void complete(const Completion& completion) {
+        // callbacks arrive in send order, so the frame is usually the oldest one
+        auto it = std::find_if(frames_.begin(), frames_.end(),
+                               [&](const Frame& frame) { return frame.next_hop == completion.peer; });
+        if (it == frames_.end()) return;
+
+        auto frame = std::move(*it);
+        frames_.erase(it);
+
+        if (completion.status == ESP_NOW_SEND_SUCCESS) return;
+
+        stats.frames_failed++;
+
+        // broadcasts are not acknowledged, so there is nothing to retry
+        if (frame.next_hop.isBroadcast()) return;
+
+        if (frame.retries >= SEND_MAX_RETRIES) {
+            ESP_LOGD(TAG, "Giving up on frame to " MACSTR, MAC2STR(frame.next_hop));
+            linkUpdate(frame.next_hop).tx_lost++;
+            return;
+        }
+
+        // retransmit to the same hop, the window slot stays occupied
+        linkUpdate(frame.next_hop).tx_retries++;
+        if (transmit(sender_, frame.next_hop, frame.buffer) != ESP_OK) {
+            stats.frames_dropped++;
+            linkUpdate(frame.next_hop).tx_lost++;
+            return;
+        }
+        frame.sent_at = xTaskGetTickCount();
+        frame.retries++;
+        frames_.push_back(std::move(frame));
+    }
+
+    void reclaimOldest() {
+        if (frames_.empty()) return;
+        if (xTaskGetTickCount() - frames_.front().sent_at < COMPLETION_TIMEOUT) return;
+
+        ESP_LOGW(TAG, "No send callback for frame to " MACSTR, MAC2STR(frames_.front().next_hop));
+        stats.completions_lost++;
+        frames_.pop_front();
+    }
+
+    layout::LinkStats& linkUpdate(const util::MacAddr& mac) {
+        auto it = std::find_if(link_updates_.begin(), link_updates_.end(),
+                               [&](const auto& update) { return update.first == mac; });
+        if (it != link_updates_.end()) return it->second;
+        return link_updates_.emplace_back(mac, layout::LinkStats{}).second;
+    }
+
+    std::shared_ptr<Sender> sender_;
+    std::deque<Frame> frames_;
+
+    // counters are collected here and only added to the layout when the lock is held anyway
+    std::vector<std::pair<util::MacAddr, layout::LinkStats>> link_updates_;
+};
+
+/**
+ * Returns true iff both this node and the given next hop support large frames. Must be called with the lock held.
+ */
+static bool supportsLargeFrames(const util::MacAddr& next_hop) {
+    // broadcasts may be received by anyone, so stick to v1
+    if (MAX_FRAME_SIZE <= ESP_NOW_MAX_DATA_LEN || next_hop.isBroadcast()) return false;
+
+    auto& layout = layout::Layout::get();
+    return layout.hasNeighbor(next_hop) && layout.getNeighbor(next_hop).max_frame_size > ESP_NOW_MAX_DATA_LEN;
+}
+
+/**
+ * Returns true iff the next hop can only read the v1 form of packets. Must be called with the lock held.
+ */
+static bool isV1Node(const util::MacAddr& next_hop) {
+    auto& layout = layout::Layout::get();
+    return !layout.hasNeighbor(next_hop) || layout.getNeighbor(next_hop).v1_node;
+}
+
+/**
+ * Returns true iff the next hop can resolve the short ID of the given address.
+ * Besides the root, a node only knows the IDs of itself and the nodes below it.
+ */
+static bool nextHopKnows(const util::MacAddr& next_hop, const util::MacAddr& mac) {
+    if (mac.isRoot()) return true;
+    if (state::getState() == state::State::REACHES_ROOT && mac == state::getRootMac()) return true;
+
+    auto& layout = layout::Layout::get();
+    if (layout.hasChild(next_hop)) {
+        // the assignment may still be on its way to the child, so only the IDs it has confirmed count
+        auto& child = layout.getChild(next_hop);
+        if (mac == next_hop) return child.short_id_confirmed;
+        return std::any_of(child.routing_table.begin(), child.routing_table.end(),
+                           [&](const layout::Node& node) { return node.mac == mac && node.short_id_confirmed; });
+    }
+
+    // the parent knows this node and everything below it, since their IDs came through it
+    if (layout.hasParent() && layout.getParent().mac == next_hop) {
+        return mac == next_hop || mac == state::getThisMac() || layout.has(mac);
+    }
+
+    // nodes that are not connected yet know nothing
+    return false;
+}
+
+/**
+ * Returns the short IDs to use in a compact header towards the next hop, if both sides know them.
+ * Broadcasts always use full headers.
+ */
+static std::optional<packets::ShortAddrs> compactAddrs(const util::MacAddr& next_hop, const util::MacAddr& from,
+                                                       const util::MacAddr& to) {
+#if CONFIG_COMPACT_HEADER
+    if (next_hop.isBroadcast() || to.isBroadcast()) return std::nullopt;
+    if (!nextHopKnows(next_hop, from) || !nextHopKnows(next_hop, to)) return std::nullopt;
+
+    auto from_id = short_id::lookup(from);
+    auto to_id = short_id::lookup(to);
+    if (!from_id || !to_id) return std::nullopt;
+
+    return packets::ShortAddrs{*from_id, *to_id};
+#else
+    return std::nullopt;
+#endif
+}
+
+/**
+ * Returns true iff IP frames sent to the next hop should carry a parity fragment, because the link loses enough frames.
+ * Must be called with the lock held.
+ */
+static bool addsParity(const util::MacAddr& next_hop) {
+#if CONFIG_FEC
+    if (next_hop.isBroadcast()) return false;
+
+    auto& layout = layout::Layout::get();
+    return layout.hasNeighbor(next_hop) &&
+           layout.getNeighbor(next_hop).link_stats.loss_permille >= CONFIG_FEC_LOSS_THRESHOLD * 10;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Returns the kind of a control packet of which only the newest one per destination matters.
+ */
+static std::optional<uint8_t> coalescingKind(const packets::Payload& payload) {
+    if (std::holds_alternative<packets::Status>(payload)) return 0;
+    // whether the root is reachable is a single state, whichever way it changed last
+    if (std::holds_alternative<packets::RootReachable>(payload) ||
+        std::holds_alternative<packets::RootUnreachable>(payload)) {
+        return 1;
+    }
+    return std::nullopt;
+}
+
 class SendSinkImpl : public SendSink {
    public:
-    SendSinkImpl(std::shared_ptr<Sender> sender, SendBehavior behavior, packets::Payload payload, uint32_t id)
-        : sender_(std::move(sender)), behavior_(std::move(behavior)), payload_(std::move(payload)), id_(id) {}
+    SendSinkImpl(HopQueues& hop_queues, Item& item)
+        : hop_queues_(hop_queues),
+          behavior_(item.behavior),
+          payload_(item.payload),
+          id_(item.id),
+          frame_(item.frame.get()),
+          frame_info_(item.frame_info),
+          seq_(item.seq),
+          priority_(priorityOf(item)),
+          deadline_(item.deadline),
+          split_queued_(item.split_queued) {}
 
     bool accept(const util::MacAddr& next_hop, const util::MacAddr& from, const util::MacAddr& to) override {
-        // serialize
-        auto buffer = packets::serialize(packets::Packet{id_, from, to, payload_});
-        uint8_t primary;
-        wifi_second_chan_t second;
-        esp_wifi_get_channel(&primary, &second);
-        ESP_LOGD(TAG, "Sending packet with id %lu on channel %d", id_, primary);
-        if (espnow_multi::EspnowMulti::getInstance()->send(sender_, next_hop.addr.data(), buffer.data(),
-                                                           buffer.size()) != ESP_OK) {
-            ESP_LOGW(TAG, "Failed to send packet!");
-            return false;
-        } else {
-            ESP_LOGV(TAG, "Sent packet!");
+        bool large_link = supportsLargeFrames(next_hop);
+        auto short_addrs = compactAddrs(next_hop, from, to);
+
+        if (frame_) {
+            // IP frames are only fragmented once they are dequeued
+            ESP_LOGD(TAG, "Queueing IP frame of size %d for " MACSTR, frame_->tot_len, MAC2STR(next_hop));
+            IpFrame ip_frame{util::refPbuf(frame_), from, to, large_link, addsParity(next_hop), frame_info_, short_addrs};
+            if (hop_queues_.supersedeAck(next_hop, ip_frame)) {
+                ESP_LOGV(TAG, "Replaced queued ACK for " MACSTR, MAC2STR(next_hop));
+                stats.acks_superseded++;
+                return true;
+            }
+            bool parity = ip_frame.hasParity();
+            auto frag_id = ip_frame.fragId();
+            if (!push(next_hop, std::move(ip_frame))) return false;
+            if (parity) stats.parity_fragments++;
+
+            // keep own frames around in case the destination misses some of their fragments
+            if (!frame_info_.resend && from == state::getThisMac() && frame_->tot_len > MAX_FRAG_PAYLOAD_SIZE) {
+                rememberFrame(frag_id, frame_, to, frame_info_);
+            }
+            return true;
+        }
+
+        auto* fragment = std::get_if<packets::DataFragment>(&payload_);
+        if (fragment && fragment->options.unpacked.large && !large_link) {
+            // large fragments never come with parity, so this is not from a node of this version
+            if (fragment->options.unpacked.frag_num == PARITY_FRAG_NUM) {
+                ESP_LOGV(TAG, "Dropping large parity fragment for " MACSTR, MAC2STR(next_hop));
+                return true;
+            }
+
+            // forwarding a large fragment over a v1 link, so split it up into the regular ones it spans
+            ESP_LOGD(TAG, "Splitting large fragment for " MACSTR, MAC2STR(next_hop));
+            auto first_frag_num = fragment->options.unpacked.frag_num * LARGE_FRAG_UNITS;
+            // the parts queued before the queue of the hop ran full are not queued again
+            auto& queued = splitQueued(next_hop);
+            for (size_t offset = queued * MAX_FRAG_PAYLOAD_SIZE; offset < fragment->data.size();
+                 offset += MAX_FRAG_PAYLOAD_SIZE) {
+                auto size = std::min<size_t>(fragment->data.size() - offset, MAX_FRAG_PAYLOAD_SIZE);
+                auto buffer = packets::serializeFragment(
+                    esp_random(), from, to, fragment->frag_id, first_frag_num + offset / MAX_FRAG_PAYLOAD_SIZE,
+                    fragment->options.unpacked.total_size, false, fragment->options.unpacked.compressed,
+                    fragment->data.data() + offset, size, short_addrs);
+                if (!push(next_hop, std::move(buffer), fragment->frag_id)) return false;
+                queued++;
+            }
             return true;
         }
+
+        if (fragment) {
+            // forwarded fragments are written straight from the received data
+            ESP_LOGD(TAG, "Queueing fragment with id %lu for " MACSTR, id_, MAC2STR(next_hop));
+            auto buffer = packets::serializeFragment(
+                id_, from, to, fragment->frag_id, fragment->options.unpacked.frag_num,
+                fragment->options.unpacked.total_size, fragment->options.unpacked.large,
+                fragment->options.unpacked.compressed, fragment->data.data(), fragment->data.size(), short_addrs);
+            return push(next_hop, std::move(buffer), fragment->frag_id);
+        }
+
+        // serialize
+        ESP_LOGD(TAG, "Queueing packet with id %lu for " MACSTR, id_, MAC2STR(next_hop));
+        auto buffer = packets::serialize(packets::Packet{id_, from, to, payloadFor(next_hop)}, short_addrs);
+        if (auto kind = coalescingKind(payload_)) {
+            return push(next_hop, std::move(buffer), std::nullopt, HopQueues::Coalescable{*kind, to, seq_});
+        }
+        return push(next_hop, std::move(buffer), fragId());
     }
 
-    void requeue() override { enqueuePayload(payload_, behavior_, id_); }
+    void requeue() override { requeued_ = true; }
+
+    bool isRequeued() const { return requeued_; }
+
+    void park(const util::MacAddr& to) override {
+        // only IP frames are worth holding back, control packets are sent again anyway
+        if (frame_ && !frame_info_.resend) {
+            ESP_LOGD(TAG, "Holding back IP frame for unreachable " MACSTR, MAC2STR(to));
+            parkFrame(to, frame_, behavior_, frame_info_);
+        }
+    }
 
    private:
-    std::shared_ptr<Sender> sender_;
+    uint8_t& splitQueued(const util::MacAddr& next_hop) {
+        auto it = std::find_if(split_queued_.begin(), split_queued_.end(),
+                               [&](const auto& entry) { return entry.first == next_hop; });
+        if (it != split_queued_.end()) return it->second;
+        return split_queued_.emplace_back(next_hop, 0).second;
+    }
+
+    /**
+     * Returns the payload in the form the next hop can read. Must be called with the lock held.
+     */
+    packets::Payload payloadFor(const util::MacAddr& next_hop) const {
+        auto* status = std::get_if<packets::Status>(&payload_);
+        if (!status || !isV1Node(next_hop)) return payload_;
+
+        // a v1 node cannot read credits, and does not limit what it sends anyway
+        auto v1_status = *status;
+        v1_status.credits = packets::UNLIMITED_CREDITS;
+        return v1_status;
+    }
+
+        std::optional<uint32_t> fragId() const {
+        auto* fragment = std::get_if<packets::DataFragment>(&payload_);
+        if (!fragment) return std::nullopt;
+        return fragment->frag_id;
+    }
+
+    bool push(const util::MacAddr& next_hop, HopQueues::Entry entry, std::optional<uint32_t> frag_id = std::nullopt,
+              std::optional<HopQueues::Coalescable> coalescable = std::nullopt) {
+        if (!hop_queues_.push(next_hop, std::move(entry), priority_, frag_id, coalescable, deadline_)) {
+            ESP_LOGD(TAG, "Queue for " MACSTR " is full!", MAC2STR(next_hop));
+            return false;
+        }
+        return true;
+    }
+
+    HopQueues& hop_queues_;
     SendBehavior behavior_;
-    packets::Payload payload_;
+    // borrowed from the item, so forwarded fragments are not copied
+    const packets::Payload& payload_;
     uint32_t id_;
+    // borrowed from the item
+    pbuf* frame_;
+    FrameInfo frame_info_;
+    uint32_t seq_;
+    packets::Priority priority_;
+    std::optional<TickType_t> deadline_;
+    // of the item, kept across retries
+    std::vector<std::pair<util::MacAddr, uint8_t>>& split_queued_;
+    bool requeued_{false};
 };
 
+/**
+ * Updates the achieved frame and byte rates once per RATE_INTERVAL.
+ */
+static void updateRates(HopQueues& hop_queues, TickType_t& last_rate_time, uint32_t& last_frames_sent) {
+    auto now = xTaskGetTickCount();
+    auto elapsed = now - last_rate_time;
+    if (elapsed < RATE_INTERVAL) return;
+
+    uint32_t frames_sent = stats.frames_sent;
+    stats.frames_per_second = (frames_sent - last_frames_sent) * configTICK_RATE_HZ / elapsed;
+    hop_queues.updateRates(elapsed);
+
+    last_rate_time = now;
+    last_frames_sent = frames_sent;
+}
+
+/**
+ * Resolves the send behavior of an item into frames for the hop queues.
+ * If the behavior retries later, the item is deferred, together with what the behavior has done so far.
+ */
+static void resolveItem(HopQueues& hop_queues, Item item, std::deque<Item>& deferred, TickType_t now) {
+    // no use spending airtime on data whose destination has already given up on it
+    if (isExpired(item, now)) {
+        ESP_LOGD(TAG, "Dropping expired item");
+        stats.frames_expired++;
+        return;
+    }
+
+    SendSinkImpl sink{hop_queues, item};
+    std::visit([&](auto& behavior) { behavior.send(sink); }, item.behavior);
+
+    if (sink.isRequeued()) deferred.push_back(std::move(item));
+}
+
+/**
+ * Resolves the items deferred earlier, then new items from the queue.
+ * Waits at most timeout for the first new item.
+ */
+static void resolveItems(HopQueues& hop_queues, InFlight& in_flight, std::deque<Item>& deferred, TickType_t timeout) {
+    // the worker is the only consumer of the queue, so it must never wait for room in it and keeps deferred items itself
+    // not taking new items while too many are deferred pushes back on the producers instead, those holding the lock
+    // never wait for room in the queue, since the lock is taken below
+    std::optional<Item> item;
+    if (deferred.size() < MAX_DEFERRED) item = popItem(deferred.empty() ? timeout : 0);
+
+    Lock lock;
+
+    // neighbors that are gone won't receive their frames anymore
+    auto& layout = layout::Layout::get();
+    auto dropped =
+        hop_queues.prune([&](const util::MacAddr& mac) { return mac.isBroadcast() || layout.hasNeighbor(mac); });
+    if (dropped > 0) {
+        ESP_LOGD(TAG, "Dropped %d frames for disconnected neighbors", dropped);
+        stats.frames_neighbor_gone += dropped;
+    }
+
+    in_flight.flushLinkUpdates(hop_queues);
+
+    auto now = xTaskGetTickCount();
+
+    // deferred items go first to keep their order, those that fail again are deferred anew
+    for (auto& retry : std::exchange(deferred, {})) {
+        resolveItem(hop_queues, std::move(retry), deferred, now);
+    }
+
+    for (int i = 0; item; item = popItem(0)) {
+        resolveItem(hop_queues, std::move(*item), deferred, now);
+        if (++i == MAX_BATCH_SIZE || deferred.size() >= MAX_DEFERRED) break;
+    }
+
+    stats.frames_evicted += hop_queues.takeEvicted();
+    stats.frames_delay_dropped += hop_queues.takeDelayDropped();
+    stats.frames_expired += hop_queues.takeExpired();
+    stats.control_coalesced += hop_queues.takeCoalesced();
+}
+
+static void recordQueueDelay(packets::Priority priority, TickType_t delay) {
+    auto bucket = std::min<size_t>(std::bit_width(pdTICKS_TO_MS(delay)), DELAY_BUCKETS - 1);
+    stats.queue_delays[static_cast<size_t>(priority)][bucket]++;
+}
+
+/**
+ * Returns the upper bound of the bucket that the given percentile of the queue delays of a class falls into.
+ */
+static uint32_t queueDelayPercentile(packets::Priority priority, uint32_t percent) {
+    auto& histogram = stats.queue_delays[static_cast<size_t>(priority)];
+    uint64_t total = 0;
+    for (const auto& count : histogram) total += count;
+    if (total == 0) return 0;
+
+    auto rank = (total * percent + 99) / 100;
+    uint64_t seen = 0;
+    size_t bucket = 0;
+    for (; bucket < DELAY_BUCKETS - 1; ++bucket) {
+        seen += histogram[bucket];
+        if (seen >= rank) break;
+    }
+    // bucket n holds the delays of bit width n
+    return (1 << bucket) - 1;
+}
+
+/**
+ * Hands frames to the driver in deficit round-robin order as long as the send window allows.
+ */
+static void transmitFrames(const std::shared_ptr<Sender>& sender, HopQueues& hop_queues, InFlight& in_flight) {
+    while (in_flight.hasSlot()) {
+        auto frame = hop_queues.pop();
+        if (!frame) break;
+        stats.frames_delay_dropped += hop_queues.takeDelayDropped();
+
+        if (transmit(sender, frame->next_hop, frame->buffer) != ESP_OK) {
+            ESP_LOGW(TAG, "Failed to send packet!");
+            stats.frames_dropped++;
+        } else {
+            ESP_LOGV(TAG, "Sent packet!");
+            if (frame->packets > 1) {
+                stats.aggregate_frames++;
+                stats.aggregated_packets += frame->packets;
+                stats.aggregation_delay_ticks += xTaskGetTickCount() - frame->enqueued_at;
+            }
+            if (packets::isCompact(frame->buffer)) stats.compact_frames++;
+            recordQueueDelay(frame->priority, xTaskGetTickCount() - frame->enqueued_at);
+            in_flight.add(frame->next_hop, std::move(frame->buffer));
+            stats.frames_sent++;
+        }
+    }
+}
+
 void worker_task(bool& should_stop, util::WaitBits& task_waitbits, int send_worker_finished_bit) {
     ESP_LOGI(TAG, "Starting!");
     // create sender
     auto sender = std::make_shared<Sender>();
+    ESP_ERROR_CHECK(sender->init());
+
+    InFlight in_flight{sender};
+    HopQueues hop_queues;
+    std::deque<Item> deferred;
 
     auto last_wake_time = xTaskGetTickCount();
+    auto last_rate_time = last_wake_time;
+    uint32_t last_frames_sent = stats.frames_sent;
 
     while (!should_stop) {
-        auto item = popItem(MIN_TIMEOUT);
-        if (!item.has_value()) {
-            // no packet in time
-            continue;
+        in_flight.processCompletions(0);
+        updateRates(hop_queues, last_rate_time, last_frames_sent);
+        pruneFrames();
+        pruneParked();
+
+        // only block on new items if there is nothing left to send, but wake up for packets held back for aggregation
+        TickType_t timeout = 0;
+        if (!hop_queues.isReady()) {
+            timeout = in_flight.empty() ? MIN_TIMEOUT : IN_FLIGHT_POLL_TIMEOUT;
+            timeout = std::min(timeout, hop_queues.nextReleaseIn());
+            // advertised credits are only taken over when resolving items
+            if (hop_queues.isStalled()) timeout = std::min(timeout, IN_FLIGHT_POLL_TIMEOUT);
+            // deferred items wait for room in the hop queues
+            if (!deferred.empty()) timeout = std::min(timeout, IN_FLIGHT_POLL_TIMEOUT);
         }
+        resolveItems(hop_queues, in_flight, deferred, timeout);
 
-        SendSinkImpl sink{sender, item->behavior, item->payload, item->id};
-        {
-            // delegate sending to send behavior
-            Lock lock;
-            std::visit([&](auto& behavior) { behavior.send(sink); }, item->behavior);
+        transmitFrames(sender, hop_queues, in_flight);
+
+        if (hop_queues.isReady()) {
+            // don't spin while the driver is busy
+            in_flight.waitForSlot();
         }
 
         // a cycle should at least take 1 tick so not to starve other tasks and trigger the watchdog
@@ -88,4 +691,33 @@ void worker_task(bool& should_stop, util::WaitBits& task_waitbits, int send_work
     task_waitbits.set(send_worker_finished_bit);
 }
 
-}  // namespace meshnow::send
\ No newline at end of file
+Stats getStats() {
+    Stats snapshot{
+        .frames_sent = stats.frames_sent,
+        .frames_dropped = stats.frames_dropped,
+        .frames_failed = stats.frames_failed,
+        .completions_lost = stats.completions_lost,
+        .frames_per_second = stats.frames_per_second,
+        .aggregate_frames = stats.aggregate_frames,
+        .aggregated_packets = stats.aggregated_packets,
+        .aggregation_delay_ticks = stats.aggregation_delay_ticks,
+        .compact_frames = stats.compact_frames,
+        .acks_superseded = stats.acks_superseded,
+        .parity_fragments = stats.parity_fragments,
+        .frames_evicted = stats.frames_evicted,
+        .frames_delay_dropped = stats.frames_delay_dropped,
+        .frames_expired = stats.frames_expired,
+        .frames_neighbor_gone = stats.frames_neighbor_gone,
+        .control_coalesced = stats.control_coalesced,
+        .queue_delay_p50_ms = {},
+        .queue_delay_p99_ms = {},
+    };
+    for (size_t i = 0; i < packets::NUM_PRIORITIES; ++i) {
+        auto priority = static_cast<packets::Priority>(i);
+        snapshot.queue_delay_p50_ms[i] = queueDelayPercentile(priority, 50);
+        snapshot.queue_delay_p99_ms[i] = queueDelayPercentile(priority, 99);
+    }
+    return snapshot;
+}
+
+}  // namespace meshnow::send
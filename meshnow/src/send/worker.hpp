@@ -1,9 +1,59 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+
+#include "packets.hpp"
 #include "util/waitbits.hpp"
 
 namespace meshnow::send {
 
+/**
+ * Counters of the send worker.
+ */
+struct Stats {
+    // frames handed to the driver
+    uint32_t frames_sent;
+    // frames the driver refused to accept
+    uint32_t frames_dropped;
+    // frames the driver reported as failed in the send callback
+    uint32_t frames_failed;
+    // frames for which the send callback never arrived
+    uint32_t completions_lost;
+    // frames handed to the driver during the last second
+    uint32_t frames_per_second;
+    // frames carrying more than one aggregated packet
+    uint32_t aggregate_frames;
+    // packets sent inside aggregate frames
+    uint32_t aggregated_packets;
+    // sum of the time the oldest packet of each aggregate frame was held back
+    uint32_t aggregation_delay_ticks;
+    // frames sent with a compact header
+    uint32_t compact_frames;
+    // queued pure TCP ACKs replaced by a newer ACK of the same flow
+    uint32_t acks_superseded;
+    // parity fragments added to IP frames
+    uint32_t parity_fragments;
+    // queued frames replaced by frames of a higher priority class
+    uint32_t frames_evicted;
+    // frames dropped from the head of a hop queue because IP traffic was waiting too long
+    uint32_t frames_delay_dropped;
+    // items and queued frames dropped because their deadline had passed before they were sent
+    uint32_t frames_expired;
+    // queued frames dropped because their next hop disconnected
+    uint32_t frames_neighbor_gone;
+    // status and root reachability packets merged with a queued one for the same destination
+    uint32_t control_coalesced;
+    // median and 99th percentile of the time frames of each priority class waited in the hop queues
+    std::array<uint32_t, packets::NUM_PRIORITIES> queue_delay_p50_ms;
+    std::array<uint32_t, packets::NUM_PRIORITIES> queue_delay_p99_ms;
+};
+
 void worker_task(bool& should_stop, util::WaitBits& task_waitbits, int send_worker_finished_bit);
 
-}
\ No newline at end of file
+/**
+ * Returns a snapshot of the send worker counters.
+ */
+Stats getStats();
+
+}  // namespace meshnow::send
@@ -0,0 +1,83 @@
+#include "short_id.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "state.hpp"
+#include "util/mutex.hpp"
+
+namespace meshnow::short_id {
+
+namespace {
+
+// the table is also read from the receive callback, which does not hold the global lock
+util::Mutex mutex;
+
+std::vector<std::pair<util::MacAddr, ShortId>> table;
+
+ShortId next_id{FIRST_NODE};
+
+bool reachesRoot() { return state::getState() == state::State::REACHES_ROOT; }
+
+}  // namespace
+
+ShortId assign(const util::MacAddr& mac) {
+    assert(state::isRoot() && "Only the root assigns IDs");
+
+    std::lock_guard lock{mutex};
+    auto it = std::find_if(table.begin(), table.end(), [&](const auto& entry) { return entry.first == mac; });
+    if (it != table.end()) return it->second;
+
+    auto id = next_id++;
+    // skip the reserved IDs on wrap-around
+    if (next_id < FIRST_NODE) next_id = FIRST_NODE;
+    table.emplace_back(mac, id);
+    return id;
+}
+
+void learn(const util::MacAddr& mac, ShortId id) {
+    if (id < FIRST_NODE) return;
+
+    std::lock_guard lock{mutex};
+    // the IDs are unique, so drop any stale mapping for either the address or the ID
+    std::erase_if(table, [&](const auto& entry) { return entry.first == mac || entry.second == id; });
+    table.emplace_back(mac, id);
+}
+
+void forget(const util::MacAddr& mac) {
+    std::lock_guard lock{mutex};
+    std::erase_if(table, [&](const auto& entry) { return entry.first == mac; });
+}
+
+void reset() {
+    std::lock_guard lock{mutex};
+    table.clear();
+}
+
+std::optional<ShortId> lookup(const util::MacAddr& mac) {
+    if (mac.isRoot()) return ROOT;
+    if (mac.isBroadcast()) return std::nullopt;
+    if (reachesRoot() && mac == state::getRootMac()) return ROOT_MAC;
+
+    std::lock_guard lock{mutex};
+    auto it = std::find_if(table.begin(), table.end(), [&](const auto& entry) { return entry.first == mac; });
+    if (it == table.end()) return std::nullopt;
+    return it->second;
+}
+
+std::optional<util::MacAddr> resolve(ShortId id) {
+    if (id == ROOT) return util::MacAddr::root();
+    if (id == ROOT_MAC) {
+        if (!reachesRoot()) return std::nullopt;
+        return state::getRootMac();
+    }
+
+    std::lock_guard lock{mutex};
+    auto it = std::find_if(table.begin(), table.end(), [&](const auto& entry) { return entry.second == id; });
+    if (it == table.end()) return std::nullopt;
+    return it->first;
+}
+
+}  // namespace meshnow::short_id
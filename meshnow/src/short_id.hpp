@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "util/mac.hpp"
+
+namespace meshnow::short_id {
+
+/**
+ * 16-bit node IDs assigned by the root, used instead of full MAC addresses in compact packet headers.
+ *
+ * Every node knows the IDs of itself and of all nodes below it, since the root announces each assignment along the path
+ * to the new node. The IDs of the root are fixed and known to everyone reaching the root.
+ */
+using ShortId = uint16_t;
+
+// the root as addressed by util::MacAddr::root()
+constexpr ShortId ROOT{0};
+// the actual MAC address of the root
+constexpr ShortId ROOT_MAC{1};
+// first ID assigned to a node
+constexpr ShortId FIRST_NODE{2};
+
+/**
+ * Root only: returns the ID of the given node, assigning a new one if it does not have one yet.
+ * IDs stay the same over the lifetime of the root, so they are not reused when a node moves around in the mesh.
+ */
+ShortId assign(const util::MacAddr& mac);
+
+/**
+ * Remembers the ID of a node, as announced by the root.
+ */
+void learn(const util::MacAddr& mac, ShortId id);
+
+/**
+ * Forgets the ID of a node that is not below this node anymore.
+ */
+void forget(const util::MacAddr& mac);
+
+/**
+ * Forgets all IDs. Must be called when disconnecting, since the next root will assign different IDs.
+ */
+void reset();
+
+/**
+ * Returns the ID of the given address, if known.
+ */
+std::optional<ShortId> lookup(const util::MacAddr& mac);
+
+/**
+ * Returns the address with the given ID, if known.
+ */
+std::optional<util::MacAddr> resolve(ShortId id);
+
+}  // namespace meshnow::short_id
@@ -6,6 +6,7 @@
 #include "layout.hpp"
 #include "packets.hpp"
 #include "send/queue.hpp"
+#include "short_id.hpp"
 #include "util/mac.hpp"
 #include "util/util.hpp"
 
@@ -33,6 +34,9 @@ void setState(State new_state) {
 
     state = new_state;
 
+    // the short IDs are only valid for the root that assigned them
+    if (new_state == State::DISCONNECTED_FROM_PARENT) short_id::reset();
+
     ESP_LOGI(TAG, "Firing event!");
     event::Internal::fire(event::InternalEvent::STATE_CHANGED, &data, sizeof(data));
 
@@ -74,4 +78,11 @@ util::MacAddr getThisMac() {
     return mac;
 }
 
+bool isForMe(const util::MacAddr& to) {
+    if (to == getThisMac()) return true;
+    if (to.isBroadcast()) return true;
+    if (to.isRoot() && isRoot()) return true;
+    return false;
+}
+
 }  // namespace meshnow::state
\ No newline at end of file
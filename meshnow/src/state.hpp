@@ -35,4 +35,10 @@ util::MacAddr getRootMac();
  */
 util::MacAddr getThisMac();
 
+/**
+ * Returns true iff a packet addressed to the given MAC address has to be processed by this device.
+ * This is the case for packets to this device, broadcasts, and packets to the root if this device is the root.
+ */
+bool isForMe(const util::MacAddr& to);
+
 }  // namespace meshnow::state
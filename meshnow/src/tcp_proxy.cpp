@@ -0,0 +1,575 @@
+#include "tcp_proxy.hpp"
+
+#include <esp_check.h>
+#include <esp_log.h>
+#include <fcntl.h>
+#include <freertos/FreeRTOS.h>
+#include <lwip/sockets.h>
+#include <sdkconfig.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "constants.hpp"
+#include "util/mutex.hpp"
+#include "util/task.hpp"
+#include "util/util.hpp"
+#include "util/waitbits.hpp"
+
+namespace meshnow::tcp_proxy {
+
+#if CONFIG_TCP_PROXY
+
+static constexpr auto TAG = CREATE_TAG("TcpProxy");
+
+// only reachable through redirection, so any port that is not used on the mesh interface of the root works
+static constexpr uint16_t PROXY_PORT{4380};
+
+// every session needs two sockets, which are limited by CONFIG_LWIP_MAX_SOCKETS
+static constexpr size_t MAX_SESSIONS{CONFIG_TCP_PROXY_SESSIONS};
+
+// closed sessions are remembered so the last segments of the node still reach the proxy
+static constexpr size_t MAX_MAPPINGS{MAX_SESSIONS * 4};
+static constexpr auto LINGER_TIME{pdMS_TO_TICKS(30000)};
+
+// redirected SYNs that the proxy did not accept after this are forgotten
+static constexpr auto ACCEPT_TIMEOUT{pdMS_TO_TICKS(10000)};
+
+// data buffered per direction of a session, on top of the socket buffers of the stack
+static constexpr size_t RELAY_BUFFER_SIZE{2048};
+
+// how often the task checks whether it should stop
+static constexpr auto POLL_INTERVAL_MS{500};
+
+static constexpr size_t IP_OFFSET{14};
+// Ethernet, IPv4 with options and TCP without options
+static constexpr size_t MAX_HEADER_SIZE{14 + 60 + 20};
+
+static constexpr uint8_t TCP_SYN{0x02};
+static constexpr uint8_t TCP_ACK{0x10};
+
+static constexpr auto FINISHED_BIT = BIT0;
+
+namespace {
+
+struct Endpoint {
+    std::array<uint8_t, 4> ip;
+    std::array<uint8_t, 2> port;
+
+    bool operator==(const Endpoint& other) const = default;
+};
+
+struct Mapping {
+    enum class State {
+        REDIRECTED,
+        ACCEPTED,
+        CLOSED,
+    };
+
+    Endpoint client;
+    Endpoint original;
+    State state;
+    TickType_t since;
+};
+
+using Header = std::array<uint8_t, MAX_HEADER_SIZE>;
+
+struct Pipe {
+    std::array<uint8_t, RELAY_BUFFER_SIZE> buffer;
+    size_t len{0};
+    // the sending side closed its connection
+    bool eof{false};
+    // the end of the data was passed on to the receiving side
+    bool shut{false};
+};
+
+struct Session {
+    Endpoint client_endpoint;
+    int client;
+    int upstream;
+    bool connected{false};
+    bool failed{false};
+    // from the node to the internet
+    Pipe up;
+    // from the internet to the node
+    Pipe down;
+};
+
+// mappings are used by the IO receive task, the TCP/IP task and the proxy task
+util::Mutex mutex;
+std::vector<Mapping> mappings;
+bool running{false};
+Endpoint proxy;
+uint32_t subnet_addr;
+uint32_t subnet_mask;
+
+// only accessed by the proxy task, start() and stop()
+int listen_sock{-1};
+std::vector<std::unique_ptr<Session>> sessions;
+
+util::Task task;
+util::WaitBits waitbits;
+std::atomic<bool> should_stop{false};
+
+struct {
+    std::atomic<uint32_t> connections;
+    std::atomic<uint32_t> bytes_up;
+    std::atomic<uint32_t> bytes_down;
+} stats;
+
+uint16_t read16(const uint8_t* data) { return static_cast<uint16_t>(data[0] << 8 | data[1]); }
+
+void write16(uint8_t* data, uint16_t value) {
+    data[0] = value >> 8;
+    data[1] = value & 0xFF;
+}
+
+Endpoint endpointOf(const sockaddr_in& addr) {
+    Endpoint endpoint;
+    std::memcpy(endpoint.ip.data(), &addr.sin_addr.s_addr, 4);
+    std::memcpy(endpoint.port.data(), &addr.sin_port, 2);
+    return endpoint;
+}
+
+sockaddr_in sockaddrOf(const Endpoint& endpoint) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    std::memcpy(&addr.sin_addr.s_addr, endpoint.ip.data(), 4);
+    std::memcpy(&addr.sin_port, endpoint.port.data(), 2);
+    return addr;
+}
+
+/**
+ * Reads the headers of an unfragmented IPv4 TCP frame.
+ * @return the offset of the TCP header, or std::nullopt if the frame is something else
+ */
+std::optional<size_t> readHeader(const pbuf* frame, Header& header) {
+    auto len = pbuf_copy_partial(frame, header.data(), std::min<size_t>(frame->tot_len, header.size()), 0);
+    if (len < IP_OFFSET + 20 + 20) return std::nullopt;
+
+    const auto* ip = header.data() + IP_OFFSET;
+    size_t ip_header_len = (ip[0] & 0x0F) * 4;
+    bool is_tcp = header[12] == 0x08 && header[13] == 0x00 && (ip[0] >> 4) == 4 && ip[9] == 6;
+    // neither more fragments nor a fragment offset
+    bool unfragmented = (ip[6] & 0x3F) == 0 && ip[7] == 0;
+    if (!is_tcp || !unfragmented || ip_header_len < 20 || IP_OFFSET + ip_header_len + 20 > len) return std::nullopt;
+
+    return IP_OFFSET + ip_header_len;
+}
+
+/**
+ * Updates a checksum for changed data without recomputing it (RFC 1624).
+ */
+void adjustChecksum(uint8_t* checksum, const uint8_t* old_data, const uint8_t* new_data, size_t len) {
+    uint32_t sum = static_cast<uint16_t>(~read16(checksum));
+    for (size_t i = 0; i < len; i += 2) {
+        sum += static_cast<uint16_t>(~read16(old_data + i));
+        sum += read16(new_data + i);
+    }
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    write16(checksum, ~sum & 0xFFFF);
+}
+
+/**
+ * Replaces the address and port at the given positions, keeping both checksums valid.
+ */
+void rewrite(Header& header, size_t tcp_offset, size_t ip_pos, size_t port_pos, const Endpoint& endpoint) {
+    auto* ip = header.data() + IP_OFFSET;
+    auto* tcp = header.data() + tcp_offset;
+
+    // the addresses are part of the pseudo header covered by the TCP checksum
+    adjustChecksum(ip + 10, ip + ip_pos, endpoint.ip.data(), 4);
+    adjustChecksum(tcp + 16, ip + ip_pos, endpoint.ip.data(), 4);
+    adjustChecksum(tcp + 16, tcp + port_pos, endpoint.port.data(), 2);
+
+    std::copy(endpoint.ip.begin(), endpoint.ip.end(), ip + ip_pos);
+    std::copy(endpoint.port.begin(), endpoint.port.end(), tcp + port_pos);
+}
+
+Mapping* findMapping(const Endpoint& client) {
+    auto it = std::find_if(mappings.begin(), mappings.end(), [&](const Mapping& m) { return m.client == client; });
+    return it == mappings.end() ? nullptr : &*it;
+}
+
+Mapping* addMapping(const Endpoint& client, const Endpoint& original) {
+    auto now = xTaskGetTickCount();
+    std::erase_if(mappings, [&](const Mapping& m) {
+        return (m.state == Mapping::State::CLOSED && now - m.since > LINGER_TIME) ||
+               (m.state == Mapping::State::REDIRECTED && now - m.since > ACCEPT_TIMEOUT);
+    });
+
+    auto open = std::count_if(mappings.begin(), mappings.end(),
+                              [](const Mapping& m) { return m.state != Mapping::State::CLOSED; });
+    if (open >= static_cast<ptrdiff_t>(MAX_SESSIONS)) return nullptr;
+
+    if (mappings.size() == MAX_MAPPINGS) {
+        // there are less open sessions than mappings, so the oldest closed one goes
+        auto oldest = std::find_if(mappings.begin(), mappings.end(),
+                                   [](const Mapping& m) { return m.state == Mapping::State::CLOSED; });
+        mappings.erase(oldest);
+    }
+
+    mappings.push_back(Mapping{client, original, Mapping::State::REDIRECTED, now});
+    return &mappings.back();
+}
+
+/**
+ * Marks the connection of the client as accepted by the proxy.
+ * @return the original destination of the connection
+ */
+std::optional<Endpoint> accepted(const Endpoint& client) {
+    std::lock_guard lock{mutex};
+    auto* mapping = findMapping(client);
+    if (!mapping) return std::nullopt;
+    mapping->state = Mapping::State::ACCEPTED;
+    mapping->since = xTaskGetTickCount();
+    return mapping->original;
+}
+
+void closed(const Endpoint& client) {
+    std::lock_guard lock{mutex};
+    auto* mapping = findMapping(client);
+    if (!mapping) return;
+    mapping->state = Mapping::State::CLOSED;
+    mapping->since = xTaskGetTickCount();
+}
+
+void setOptions(int sock) {
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    // data is already delayed by the relay, so small writes like MQTT messages are not held back any further
+    int no_delay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+}
+
+bool wouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS; }
+
+/**
+ * Reads from the socket into the pipe.
+ * @return false if the connection failed
+ */
+bool receive(int sock, Pipe& pipe) {
+    auto n = recv(sock, pipe.buffer.data() + pipe.len, pipe.buffer.size() - pipe.len, 0);
+    if (n > 0) {
+        pipe.len += n;
+    } else if (n == 0) {
+        pipe.eof = true;
+    } else if (!wouldBlock()) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes from the pipe into the socket.
+ * @return false if the connection failed
+ */
+bool transmit(int sock, Pipe& pipe, std::atomic<uint32_t>& counter) {
+    auto n = send(sock, pipe.buffer.data(), pipe.len, 0);
+    if (n > 0) {
+        std::memmove(pipe.buffer.data(), pipe.buffer.data() + n, pipe.len - n);
+        pipe.len -= n;
+        counter += n;
+    } else if (n < 0 && !wouldBlock()) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Passes on the end of the data once everything before it is sent.
+ */
+void finish(int sock, Pipe& pipe) {
+    if (pipe.eof && pipe.len == 0 && !pipe.shut) {
+        shutdown(sock, SHUT_WR);
+        pipe.shut = true;
+    }
+}
+
+void watch(const Session& session, fd_set& readable, fd_set& writable, int& max_fd) {
+    // the node may send data before the upstream connection is established
+    if (!session.up.eof && session.up.len < RELAY_BUFFER_SIZE) FD_SET(session.client, &readable);
+    if (session.down.len > 0) FD_SET(session.client, &writable);
+
+    if (!session.connected) {
+        // the upstream connection is established once it becomes writable
+        FD_SET(session.upstream, &writable);
+    } else {
+        if (!session.down.eof && session.down.len < RELAY_BUFFER_SIZE) FD_SET(session.upstream, &readable);
+        if (session.up.len > 0) FD_SET(session.upstream, &writable);
+    }
+
+    max_fd = std::max({max_fd, session.client, session.upstream});
+}
+
+void relay(Session& session, const fd_set& readable, const fd_set& writable) {
+    if (!session.connected && FD_ISSET(session.upstream, &writable)) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        getsockopt(session.upstream, SOL_SOCKET, SO_ERROR, &error, &len);
+        if (error != 0) {
+            ESP_LOGD(TAG, "Upstream connection failed: errno %d", error);
+            session.failed = true;
+            return;
+        }
+        session.connected = true;
+    }
+
+    bool ok = true;
+    if (FD_ISSET(session.client, &readable)) ok &= receive(session.client, session.up);
+    if (session.connected && FD_ISSET(session.upstream, &readable)) ok &= receive(session.upstream, session.down);
+    if (session.connected && FD_ISSET(session.upstream, &writable)) {
+        ok &= transmit(session.upstream, session.up, stats.bytes_up);
+    }
+    if (FD_ISSET(session.client, &writable)) ok &= transmit(session.client, session.down, stats.bytes_down);
+    session.failed = !ok;
+
+    if (session.connected) finish(session.upstream, session.up);
+    finish(session.client, session.down);
+}
+
+void closeSession(const Session& session) {
+    close(session.client);
+    close(session.upstream);
+    closed(session.client_endpoint);
+}
+
+void acceptConnection() {
+    sockaddr_in peer{};
+    socklen_t addr_len = sizeof(peer);
+    int client = accept(listen_sock, reinterpret_cast<sockaddr*>(&peer), &addr_len);
+    if (client < 0) return;
+
+    auto client_endpoint = endpointOf(peer);
+    auto original = accepted(client_endpoint);
+    if (!original || sessions.size() == MAX_SESSIONS) {
+        close(client);
+        closed(client_endpoint);
+        return;
+    }
+
+    int upstream = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (upstream < 0) {
+        ESP_LOGW(TAG, "Failed to create upstream socket: errno %d", errno);
+        close(client);
+        closed(client_endpoint);
+        return;
+    }
+    setOptions(client);
+    setOptions(upstream);
+
+    auto destination = sockaddrOf(*original);
+    if (connect(upstream, reinterpret_cast<sockaddr*>(&destination), sizeof(destination)) < 0 && !wouldBlock()) {
+        ESP_LOGD(TAG, "Failed to connect upstream: errno %d", errno);
+        close(client);
+        close(upstream);
+        closed(client_endpoint);
+        return;
+    }
+
+    auto session = std::make_unique<Session>();
+    session->client_endpoint = client_endpoint;
+    session->client = client;
+    session->upstream = upstream;
+    sessions.push_back(std::move(session));
+    stats.connections++;
+}
+
+void serve() {
+    while (!should_stop) {
+        fd_set readable;
+        fd_set writable;
+        FD_ZERO(&readable);
+        FD_ZERO(&writable);
+        int max_fd = listen_sock;
+        // new connections wait in the backlog while all sessions are busy
+        if (sessions.size() < MAX_SESSIONS) FD_SET(listen_sock, &readable);
+        for (const auto& session : sessions) watch(*session, readable, writable, max_fd);
+        timeval timeout{.tv_sec = 0, .tv_usec = POLL_INTERVAL_MS * 1000};
+
+        auto ready = select(max_fd + 1, &readable, &writable, nullptr, &timeout);
+        if (ready < 0) {
+            ESP_LOGW(TAG, "Waiting for connections failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(POLL_INTERVAL_MS));
+            continue;
+        }
+
+        for (auto& session : sessions) relay(*session, readable, writable);
+        std::erase_if(sessions, [](const auto& session) {
+            bool done = session->failed || (session->up.shut && session->down.shut);
+            if (done) closeSession(*session);
+            return done;
+        });
+
+        if (FD_ISSET(listen_sock, &readable)) acceptConnection();
+    }
+
+    for (const auto& session : sessions) closeSession(*session);
+    sessions.clear();
+
+    waitbits.set(FINISHED_BIT);
+}
+
+}  // namespace
+
+void redirect(pbuf* frame) {
+    Header header;
+    auto tcp_offset = readHeader(frame, header);
+    if (!tcp_offset) return;
+
+    const auto* ip = header.data() + IP_OFFSET;
+    const auto* tcp = header.data() + *tcp_offset;
+    Endpoint client{{ip[12], ip[13], ip[14], ip[15]}, {tcp[0], tcp[1]}};
+    Endpoint destination{{ip[16], ip[17], ip[18], ip[19]}, {tcp[2], tcp[3]}};
+    bool syn = (tcp[13] & (TCP_SYN | TCP_ACK)) == TCP_SYN;
+
+    {
+        std::lock_guard lock{mutex};
+        if (!running) return;
+
+        // traffic within the mesh, including to the root itself, stays as it is
+        uint32_t destination_addr;
+        std::memcpy(&destination_addr, destination.ip.data(), 4);
+        if ((destination_addr & subnet_mask) == (subnet_addr & subnet_mask)) return;
+
+        auto* mapping = findMapping(client);
+        if (mapping && mapping->original != destination) {
+            // the node reused the port for another destination
+            if (!syn) return;
+            std::erase_if(mappings, [&](const Mapping& m) { return m.client == client; });
+            mapping = nullptr;
+        }
+        // connections that started before the proxy or did not fit into it pass through NAPT
+        if (!mapping && (!syn || !addMapping(client, destination))) return;
+    }
+
+    rewrite(header, *tcp_offset, 16, 2, proxy);
+    pbuf_take_at(frame, header.data(), *tcp_offset + 20, 0);
+}
+
+util::PbufPtr restore(util::PbufPtr frame) {
+    Header header;
+    auto tcp_offset = readHeader(frame.get(), header);
+    if (!tcp_offset) return frame;
+
+    const auto* ip = header.data() + IP_OFFSET;
+    const auto* tcp = header.data() + *tcp_offset;
+    Endpoint source{{ip[12], ip[13], ip[14], ip[15]}, {tcp[0], tcp[1]}};
+    Endpoint client{{ip[16], ip[17], ip[18], ip[19]}, {tcp[2], tcp[3]}};
+
+    Endpoint original;
+    {
+        std::lock_guard lock{mutex};
+        if (!running || source != proxy) return frame;
+        auto* mapping = findMapping(client);
+        if (!mapping) return frame;
+        original = mapping->original;
+    }
+
+    // the stack may still retransmit its own pbuf, so the rewritten frame has to be a copy
+    util::PbufPtr copy{pbuf_alloc(PBUF_RAW, frame->tot_len, PBUF_RAM)};
+    if (!copy) return nullptr;
+    pbuf_copy_partial(frame.get(), copy->payload, frame->tot_len, 0);
+
+    rewrite(header, *tcp_offset, 12, 0, original);
+    pbuf_take_at(copy.get(), header.data(), *tcp_offset + 20, 0);
+    return copy;
+}
+
+esp_err_t start(uint32_t addr, uint32_t netmask) {
+    ESP_LOGI(TAG, "Starting TCP proxy");
+
+    ESP_RETURN_ON_ERROR(waitbits.init(), TAG, "Failed to initialize proxy task waitbits");
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listen_sock < 0) {
+        ESP_LOGE(TAG, "Failed to create proxy socket");
+        return ESP_FAIL;
+    }
+
+    // only the redirected connections of the nodes arrive here
+    sockaddr_in listen_addr{};
+    listen_addr.sin_family = AF_INET;
+    listen_addr.sin_port = htons(PROXY_PORT);
+    listen_addr.sin_addr.s_addr = addr;
+    if (bind(listen_sock, reinterpret_cast<sockaddr*>(&listen_addr), sizeof(listen_addr)) < 0 ||
+        listen(listen_sock, MAX_SESSIONS) < 0) {
+        ESP_LOGE(TAG, "Failed to listen on proxy socket: errno %d", errno);
+        close(listen_sock);
+        listen_sock = -1;
+        return ESP_FAIL;
+    }
+
+    {
+        std::lock_guard lock{mutex};
+        proxy = endpointOf(listen_addr);
+        subnet_addr = addr;
+        subnet_mask = netmask;
+        running = true;
+    }
+
+    should_stop = false;
+    auto ret = task.init(util::TaskSettings("tcp_proxy", 4096, TASK_PRIORITY, util::CPU::PRO_CPU), &serve);
+    if (ret != ESP_OK) {
+        {
+            std::lock_guard lock{mutex};
+            running = false;
+        }
+        close(listen_sock);
+        listen_sock = -1;
+        ESP_LOGE(TAG, "Failed to start proxy task");
+        return ret;
+    }
+
+    return ESP_OK;
+}
+
+void stop() {
+    if (listen_sock < 0) return;
+
+    ESP_LOGI(TAG, "Stopping TCP proxy");
+
+    {
+        std::lock_guard lock{mutex};
+        running = false;
+        mappings.clear();
+    }
+
+    should_stop = true;
+    waitbits.wait(FINISHED_BIT, true, true, portMAX_DELAY);
+    task = util::Task();
+
+    close(listen_sock);
+    listen_sock = -1;
+}
+
+Stats getStats() {
+    return Stats{
+        .connections = stats.connections,
+        .bytes_up = stats.bytes_up,
+        .bytes_down = stats.bytes_down,
+    };
+}
+
+#else
+
+// without the proxy, every connection passes through NAPT unchanged
+
+void redirect(pbuf*) {}
+
+util::PbufPtr restore(util::PbufPtr frame) { return frame; }
+
+esp_err_t start(uint32_t, uint32_t) { return ESP_ERR_NOT_SUPPORTED; }
+
+void stop() {}
+
+Stats getStats() { return Stats{}; }
+
+#endif
+
+}  // namespace meshnow::tcp_proxy
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <esp_err.h>
+
+#include <cstdint>
+
+#include "util/pbuf.hpp"
+
+namespace meshnow::tcp_proxy {
+
+/**
+ * Root only: splits TCP connections of the nodes to hosts outside the mesh in two.
+ *
+ * The SYN of a new connection is redirected to a local listening socket, so the root itself terminates the connection
+ * of the node and opens its own connection to the original destination. Data is relayed between both connections. Loss
+ * on the mesh is then recovered by the root with the short RTT of the mesh, instead of end-to-end with the RTT of the
+ * internet path, and the other way round.
+ *
+ * Replies of the root are rewritten to carry the original destination as source, so the proxy is invisible to the
+ * nodes. Connections that do not fit into the proxy pass through NAPT unchanged.
+ */
+
+struct Stats {
+    // connections split by the proxy
+    uint32_t connections;
+    // bytes relayed from the nodes to the internet
+    uint32_t bytes_up;
+    // bytes relayed from the internet to the nodes
+    uint32_t bytes_down;
+};
+
+/**
+ * Redirects a frame received from the mesh to the proxy, if it belongs to a proxied connection or starts a new one.
+ * Rewrites the frame in place.
+ */
+void redirect(pbuf* frame);
+
+/**
+ * Restores the original destination as the source of a frame that the proxy sends to a node.
+ * @return the frame to send instead, which is a rewritten copy for frames of the proxy, or nullptr to drop the frame
+ */
+util::PbufPtr restore(util::PbufPtr frame);
+
+/**
+ * Starts the proxy on the given address.
+ * @param addr the address of the mesh interface of the root, in network byte order
+ * @param netmask the netmask of the mesh, in network byte order
+ */
+esp_err_t start(uint32_t addr, uint32_t netmask);
+
+/**
+ * Stops the proxy, closing all of its connections.
+ */
+void stop();
+
+Stats getStats();
+
+}  // namespace meshnow::tcp_proxy
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#include <cassert>
+
+namespace meshnow::util {
+
+/**
+ * FreeRTOS mutex that can be used with std::lock_guard.
+ */
+class Mutex {
+   public:
+    Mutex() : handle_(xSemaphoreCreateMutex()) { assert(handle_ && "Failed to create mutex!"); }
+
+    ~Mutex() { vSemaphoreDelete(handle_); }
+
+    Mutex(const Mutex&) = delete;
+    Mutex& operator=(const Mutex&) = delete;
+
+    void lock() { xSemaphoreTake(handle_, portMAX_DELAY); }
+
+    void unlock() { xSemaphoreGive(handle_); }
+
+   private:
+    SemaphoreHandle_t handle_;
+};
+
+}  // namespace meshnow::util
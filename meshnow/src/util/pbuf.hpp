@@ -0,0 +1,26 @@
+#pragma once
+
+#include <lwip/pbuf.h>
+
+#include <memory>
+
+namespace meshnow::util {
+
+struct PbufDeleter {
+    void operator()(pbuf* p) const { pbuf_free(p); }
+};
+
+/**
+ * Owns one reference to an lwIP pbuf.
+ */
+using PbufPtr = std::unique_ptr<pbuf, PbufDeleter>;
+
+/**
+ * Takes another reference to the given pbuf.
+ */
+inline PbufPtr refPbuf(pbuf* p) {
+    pbuf_ref(p);
+    return PbufPtr{p};
+}
+
+}  // namespace meshnow::util
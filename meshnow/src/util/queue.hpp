@@ -42,13 +42,18 @@ class Queue {
     bool push_back(T&& item, TickType_t ticksToWait) const {
         alignas(T) uint8_t buffer[sizeof(T)];
         new (buffer) T{std::move(item)};
-        return xQueueSendToBack(queue_handle_.get(), static_cast<const void*>(buffer), ticksToWait);
+        if (xQueueSendToBack(queue_handle_.get(), static_cast<const void*>(buffer), ticksToWait)) return true;
+        // the queue did not take over the item, so it is still ours to destroy
+        reinterpret_cast<T*>(buffer)->~T();
+        return false;
     }
 
     bool push_front(T&& item, TickType_t ticksToWait) const {
         alignas(T) uint8_t buffer[sizeof(T)];
         new (buffer) T{std::move(item)};
-        return xQueueSendToFront(queue_handle_.get(), static_cast<const void*>(buffer), ticksToWait);
+        if (xQueueSendToFront(queue_handle_.get(), static_cast<const void*>(buffer), ticksToWait)) return true;
+        reinterpret_cast<T*>(buffer)->~T();
+        return false;
     }
 
     std::optional<T> pop(TickType_t ticksToWait) const {